@@ -24,6 +24,11 @@ const char *version = "1.4";
 #include <stdlib.h>
 #include <errno.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <libperfstat.h>
 
 #ifndef XINTFRAC		/* for timebase calculations... */
@@ -47,9 +52,21 @@ enum {
 /* string representations of the return codes */
 char *states[5]={"OK","WARNING","CRITICAL","UNKNOWN","DEPENDENT"};
 
+/* layout and reader of the sampler daemon snapshot */
+#include "shm_snapshot.h"
+
+/* getopt return values of long options without a single character equivalent */
+enum {
+	OPT_SHM = 256,
+	OPT_WINDOW,
+	OPT_VCSW_WARNING,
+	OPT_VCSW_CRITICAL
+};
+
 /* initial state values */
 int ent_pool_state=STATE_OK, temp_state=STATE_OK;
 int ent_state=STATE_OK;
+int vcsw_state=STATE_OK;
 int pool_state=STATE_OK, pool_free_state=STATE_OK;
 int syspool_state=STATE_OK, syspool_free_state=STATE_OK;
 
@@ -58,16 +75,33 @@ int interval=1;			/* default interval in seconds between the 2 perflib calls = m
 int verbose=FALSE;		/* only 1 verbose level... violating the plugin recommendations here */
 int strict=FALSE;		/* additional sanity checking of various system values */
 int pool_check_requested=0;	/* indicator for pool check requests, to react properly when there are no pools to check */
+int shm_client=FALSE;		/* take the results from the sampler daemon instead of sampling */
+int shm_window=0;		/* window of the sampler daemon results, 0 is its sampling interval */
+
+/* nagios plugin threshold ranges */
+#include "nagios_range.h"
 
 /* monitoring variables */
-double pool_critical_pct=0, pool_warning_pct=0;
-double pool_critical=0, pool_warning=0;
-double pool_free_critical_pct=0, pool_free_warning_pct=0;
-double pool_free_critical=0, pool_free_warning=0;
-double system_critical_pct=0, system_warning_pct=0;
-double system_critical=0, system_warning=0;
-double system_free_critical_pct=0, system_free_warning_pct=0;
-double system_free_critical=0, system_free_warning=0;
+struct range pool_critical_pct, pool_warning_pct;
+struct range pool_critical, pool_warning;
+struct range pool_free_critical_pct, pool_free_warning_pct;
+struct range pool_free_critical, pool_free_warning;
+struct range system_critical_pct, system_warning_pct;
+struct range system_critical, system_warning;
+struct range system_free_critical_pct, system_free_warning_pct;
+struct range system_free_critical, system_free_warning;
+struct range vcsw_invol_critical, vcsw_invol_warning;
+
+/* monitoring results, calculated from 2 perfstat samples or taken from the sampler daemon */
+perfstat_partition_type_t lpar_type;
+double vcsw_vol=0, vcsw_invol=0;	/* virtual context switches per vCPU and second */
+int vcsw_available=FALSE;		/* measured over a period with vCPUs */
+u_longlong_t shcpus_in_sys=0;
+double pool_busy_time=0, pool_busy_time_pct=0, shcpu_busy_time=0, shcpu_busy_time_pct=0;
+double shcpu_free_time=0, shcpu_free_time_pct=0;
+double pool_free_time=0, pool_free_time_pct=0;
+int pool_id;
+int phys_cpus_pool=0;
 
 
 /* helper functions "stolen" from util.c and utilbase.c */
@@ -237,6 +271,107 @@ int get_new_lower_status(char *verbose_message, double value, double warn, doubl
 	return state;
 }
 
+/* calculate the monitoring results from the counters at the start (last) and the end (now)
+ * of the measurement period */
+void calculate_values(perfstat_partition_total_t *last, perfstat_partition_total_t *now)
+{
+    u_longlong_t dlt_pool_busy_time, dlt_shcpu_busy_time;
+    u_longlong_t delta_time_base;
+    double seconds;
+
+    /* LPAR mode at the end of the measurement period */
+    lpar_type = now->type;
+
+    /* delta pool usage values */
+    dlt_pool_busy_time = now->pool_busy_time - last->pool_busy_time;
+    dlt_shcpu_busy_time = now->shcpu_busy_time - last->shcpu_busy_time;
+
+    /* get pool sizes */
+    phys_cpus_pool = now->phys_cpus_pool;
+    shcpus_in_sys = now->shcpus_in_sys;
+
+    /* pool id of this lpar */
+    pool_id = now->pool_id;
+
+    /* new delta timer */
+    delta_time_base = now->timebase_last - last->timebase_last;
+
+    /* virtual context switches per vCPU and second, involuntary ones are hypervisor preemptions */
+    seconds = XINTFRAC * (double)delta_time_base / 1000000000.0;
+    vcsw_available = seconds > 0 && now->online_cpus > 0;
+    if (vcsw_available) {
+	vcsw_vol = (double)(now->vol_virt_cswitch - last->vol_virt_cswitch) / seconds / (double)now->online_cpus;
+	vcsw_invol = (double)(now->invol_virt_cswitch - last->invol_virt_cswitch) / seconds / (double)now->online_cpus;
+    }
+
+    /* Shared LPAR with pool authority enabled -> we have pool data */
+    if (now->type.b.shared_enabled && now->type.b.pool_util_authority) {
+        /* Available Pool Processor (app) */
+	pool_free_time=(double)(now->pool_idle_time - last->pool_idle_time) / (XINTFRAC*(double)delta_time_base);
+	pool_free_time_pct=pool_free_time*100/phys_cpus_pool;
+
+        /* busy CPUs in Pool = phys_cpus_pool - app */
+	pool_busy_time=(double)dlt_pool_busy_time/(XINTFRAC*(double)delta_time_base);
+	pool_busy_time_pct= pool_busy_time * 100 / phys_cpus_pool;
+
+        /* busy CPUs in managed system = Shared Pool 0 usage */
+	shcpu_busy_time=(double)dlt_shcpu_busy_time/(XINTFRAC*(double)delta_time_base);
+	shcpu_busy_time_pct=shcpu_busy_time * 100 / (double)shcpus_in_sys;
+	/* free CPUs in managed system = busy CPUs - shcpus_in_sys */
+	shcpu_free_time=shcpus_in_sys - shcpu_busy_time;
+	shcpu_free_time_pct=shcpu_free_time * 100 / (double)shcpus_in_sys;
+    }
+}
+
+/* take the monitoring results from the latest consistent snapshot of the sampler daemon */
+void read_shm_snapshot(void)
+{
+	struct shm_snapshot snapshot;
+	struct shm_window *w;
+
+	copy_shm_snapshot("CPU_POOLS", &snapshot, verbose);
+	w = &snapshot.windows[shm_window];
+	if (verbose && shm_window) { printf("Window %s covers %.0f seconds\n", shm_window_names[shm_window], w->seconds); }
+
+	lpar_type = snapshot.type;
+	pool_id = snapshot.pool_id;
+	phys_cpus_pool = snapshot.phys_cpus_pool;
+	shcpus_in_sys = snapshot.shcpus_in_sys;
+	pool_busy_time = w->pool_busy_time;
+	pool_busy_time_pct = w->pool_busy_time_pct;
+	pool_free_time = w->pool_free_time;
+	pool_free_time_pct = w->pool_free_time_pct;
+	shcpu_busy_time = w->shcpu_busy_time;
+	shcpu_busy_time_pct = w->shcpu_busy_time_pct;
+	shcpu_free_time = w->shcpu_free_time;
+	shcpu_free_time_pct = w->shcpu_free_time_pct;
+	vcsw_vol = w->vcsw_vol;
+	vcsw_invol = w->vcsw_invol;
+	vcsw_available = w->seconds > 0;
+}
+
+/* involuntary virtual context switches in the monitor output, only when a threshold is set */
+char *vcsw_status(void)
+{
+	static char output[64];
+
+	output[0] = 0;
+	if (vcsw_invol_warning.set || vcsw_invol_critical.set)
+		snprintf(output, sizeof(output), " vcsw_invol=%.2f(%s)", vcsw_invol, states[vcsw_state]);
+	return output;
+}
+
+/* virtual context switches in the performance data, only when they were measured */
+char *vcsw_perfdata(void)
+{
+	static char output[64];
+
+	output[0] = 0;
+	if (vcsw_available)
+		snprintf(output, sizeof(output), " vcsw_vol=%.2f vcsw_invol=%.2f", vcsw_vol, vcsw_invol);
+	return output;
+}
+
 void print_version(const char *progname,const char *version)
 {
 	printf("%s v%s\n",progname,version);
@@ -248,7 +383,9 @@ void print_usage (void)
 	printf ("%s\n", _("Usage:"));
  	printf (" %s [ -pw=limit ] [ -pc=limit ]\n", progname);
  	printf ("     [ -pfw=limit ] [ -pfc=limit ] [ -sw=limit ] [ -sc=limit ]\n");
- 	printf ("     [ -sfw=limit ] [ -sfc=limit ] [ -strict ] [ -i=interval ] [ -h ] [ -v ] [ -V ]\n\n");
+ 	printf ("     [ -sfw=limit ] [ -sfc=limit ] [ -strict ] [ -i=interval ] [ --shm ]\n");
+ 	printf ("     [ --window=1m|5m|15m ] [ --vcsw-invol-warning=limit ] [ --vcsw-invol-critical=limit ]\n");
+ 	printf ("     [ -h ] [ -v ] [ -V ]\n\n");
 }
 
 void print_help (void)
@@ -312,9 +449,19 @@ void print_help (void)
 	printf (" %s\n", "-sfc, --system-free-critical=PERCENT%");
 	printf ("    %s\n", _("Exit with CRITICAL status if number of free system pool cpus is lower"));
 	printf ("    %s\n", _("than PERCENT of available cpus"));
+	printf (" %s\n", "--vcsw-invol-warning=VALUE, --vcsw-invol-critical=VALUE");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the involuntary virtual context"));
+	printf ("    %s\n", _("switches per vCPU and second are higher than VALUE. Rising values show"));
+	printf ("    %s\n", _("pool contention before the pool is full"));
 	printf ("\n");
 	printf (" %s\n", "-i, --interval=INTEGER");
 	printf ("    %s\n", _("measurement interval in INTEGER seconds (1..30). Default is 1"));
+	printf (" %s\n", "--shm");
+	printf ("    %s\n", _("Check the latest results of the sampler daemon (check_ent_pools --daemon),"));
+	printf ("    %s\n", _("no sampling and no sleep"));
+	printf (" %s\n", "--window=1m|5m|15m");
+	printf ("    %s\n", _("Check the results of the sampler daemon over the last 1, 5 or 15 minutes"));
+	printf ("    %s\n", _("instead of its last interval. Needs --shm"));
 	printf (" %s\n", "-x, -strict, --strict");
 	printf ("    %s\n", _("Exit with CRITICAL status if pool values are obviously wrong"));
 	printf ("    %s\n", _("e.g. pool sizes or usage values are 0, number of pool cpus is higher than"));
@@ -332,6 +479,12 @@ void print_help (void)
 	printf ("%s\n", _("INTEGER is a positive integer number"));
 	printf ("%s\n", _("PERCENT is a positive integer number in the range 1..100"));
 	printf ("\n");
+	printf ("%s\n", _("Instead of a VALUE or PERCENT the threshold options -pw, -pc, -pfw, -pfc, -sw,"));
+	printf ("%s\n", _("-sc, -sfw, -sfc and --vcsw-invol-* accept a nagios range [@][start:][end],"));
+	printf ("%s\n", _("followed by % for a percentage. The check alerts outside of start..end, or inside"));
+	printf ("%s\n", _("with @. start ~ is minus infinity, a missing end is infinity. A bare VALUE or"));
+	printf ("%s\n", _("PERCENT keeps its old meaning, the free options alert below and all others above it"));
+	printf ("\n");
 	printf ("%s\n", _("Warning and critical checks can be configured independently, critical checks"));
         printf ("%s\n", _("without warnings are possible"));
 	printf ("%s\n", _("Exactly one PERCENT and one VALUE for each option is possible, see examples"));
@@ -353,6 +506,64 @@ void print_help (void)
 
 }
 
+/* threshold -pw, -pc, -pfw, -pfc, -sw, -sc, -sfw, -sfc, --vcsw-invol-warning or --vcsw-invol-critical,
+ * only once each for value and percentage (PERCENT% or a range with %). pct is NULL when only values are
+ * allowed, lower when a bare number is a lower limit.
+ * Bare numbers are checked as before ranges were supported. */
+void parse_threshold(char *option, char *arg, int lower, struct range *value, struct range *pct)
+{
+	char range[64], *from, *to;
+	struct range *r;
+	int percent;
+
+	/* the range without % */
+	for (from = arg, to = range, percent = FALSE; *from && to < range + sizeof(range) - 1; from++)
+		if (*from == '%')
+			percent = TRUE;
+		else
+			*to++ = *from;
+	*to = 0;
+
+	r = percent ? pct : value;
+	if (r == NULL) {
+		if (value == NULL)
+			printf("ERROR: -%s %s out of range: Allowed 1%%..100%%\n", option, arg);
+		else
+			printf("ERROR: -%s %s has to be a value, not a percentage!\n", option, arg);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (r->set) {
+		printf("ERROR: -%s already set! Don't specify more than once!\n", option);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (!strpbrk(range, "@:~")) {
+		/* pct ranges from 1 to 100% */
+		if (percent) {
+			if (!is_intpercent(range)) {
+				printf("ERROR: -%s %s out of range! Allowed 1%%..100%%\n", option, arg);
+				print_usage();
+				exit(STATE_UNKNOWN);
+			}
+		} else {
+			if (!is_positive(range)) {
+				printf("ERROR: -%s %s out of range: Argument has to be >0 !\n", option, arg);
+				print_usage();
+				exit(STATE_UNKNOWN);
+			}
+			/* we use only 1 digit after the comma, remove all the others */
+			snprintf(range, sizeof(range), "%.1f", (double)(int)(atof(range)*10)/10);
+		}
+	}
+	if (!parse_range(range, lower, r)) {
+		printf("ERROR: -%s %s is no valid range! Use [@][start:][end], start ~ is minus infinity\n", option, arg);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (verbose) { printf("threshold -%s=%s%.2f:%.2f%s\n", option, r->inside ? "@" : "", r->start, r->end, percent ? "%" : ""); }
+}
+
 /* main */
 int main(int argc, char* argv[])
 {
@@ -380,6 +591,10 @@ int main(int argc, char* argv[])
 	{"x",                    no_argument,       0, 'x'},
 	{"i",                    required_argument, 0, 'i'},
 	{"interval",             required_argument, 0, 'i'},
+	{"shm",                  no_argument,       0, OPT_SHM},
+	{"window",               required_argument, 0, OPT_WINDOW},
+	{"vcsw-invol-warning",   required_argument, 0, OPT_VCSW_WARNING},
+	{"vcsw-invol-critical",  required_argument, 0, OPT_VCSW_CRITICAL},
 	{"verbose",              no_argument,       0, 'v'},
 	{"version",              no_argument,       0, 'V'},
 	{"help",                 no_argument,       0, 'h'},
@@ -402,308 +617,36 @@ int main(int argc, char* argv[])
 	    /* if (verbose) { printf("Option verbose selected\n"); } */
 	    break;
     	case 'p':
-	    /* if (verbose) { printf("Option pool-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( pool_critical_pct != 0 ) {
-			    printf("ERROR: -pc already set to %.0f%%! Don't specify more than once!\n",pool_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    pool_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;      /* to exit easily later if lpar mode is dedicated donating */
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -pc %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_critical%%=%.0f\n",pool_critical_pct); }
-	    } else {
-		    if ( pool_critical != 0 ) {
-			    printf("ERROR: -pc already set to %.1f! Don't specify more than once!\n",pool_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    pool_critical=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -pc %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_critical=%.1f\n",pool_critical); }
-	    } 
+	    parse_threshold("pc", optarg, FALSE, &pool_critical, &pool_critical_pct);
+	    pool_check_requested+=1;      /* to exit easily later if lpar mode is dedicated donating */
 	    break;
     	case 'q':
-	    /* if (verbose) { printf("Option pool-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( pool_warning_pct != 0 ) {
-			    printf("ERROR: -pw already set to %.0f%%! Don't specify more than once!\n",pool_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    pool_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -pw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_warning%%=%.0f\n",pool_warning_pct); }
-	    } else {
-		    if ( pool_warning != 0 ) {
-			    printf("ERROR: -pw already set to %.1f! Don't specify more than once!\n",pool_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    pool_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -pw %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_warning=%.1f\n",pool_warning); }
-	    } 
+	    parse_threshold("pw", optarg, FALSE, &pool_warning, &pool_warning_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'l':
-	    /* if (verbose) { printf("Option pool-free-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( pool_free_critical_pct != 0 ) {
-			    printf("ERROR: -pfc already set to %.0f%%! Don't specify more than once!\n",pool_free_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    pool_free_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -pfc %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_free_critical%%=%.0f\n",pool_free_critical_pct); }
-	    } else {
-		    if ( pool_free_critical != 0 ) {
-			    printf("ERROR: -pfc already set to %.1f! Don't specify more than once!\n",pool_free_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    pool_free_critical=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -pfc %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_free_critical=%.1f\n",pool_free_critical); }
-	    } 
+	    parse_threshold("pfc", optarg, TRUE, &pool_free_critical, &pool_free_critical_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'm':
-	    /* if (verbose) { printf("Option pool-free-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( pool_free_warning_pct != 0 ) {
-			    printf("ERROR: -pfw already set to %.0f%%! Don't specify more than once!\n",pool_free_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    pool_free_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -pfw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_free_warning%%=%.0f\n",pool_free_warning_pct); }
-	    } else {
-		    if ( pool_free_warning != 0 ) {
-			    printf("ERROR: -pfw already set to %.1f! Don't specify more than once!\n",pool_free_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    pool_free_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -pfw %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_free_warning=%.1f\n",pool_free_warning); }
-	    } 
+	    parse_threshold("pfw", optarg, TRUE, &pool_free_warning, &pool_free_warning_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 's':
-	    /* if (verbose) { printf("Option system-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( system_warning_pct != 0 ) {
-			    printf("ERROR: -sw already set to %.0f%%! Don't specify more than once!\n",system_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    system_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -sw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_warning%%=%.0f\n",system_warning_pct); }
-	    } else {
-		    if ( system_warning != 0 ) {
-			    printf("ERROR: -sw already set to %.1f! Don't specify more than once!\n",system_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    system_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -sw %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_warning=%.1f\n",system_warning); }
-	    } 
+	    parse_threshold("sw", optarg, FALSE, &system_warning, &system_warning_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 't':
-	    /* if (verbose) { printf("Option system-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( system_critical_pct != 0 ) {
-			    printf("ERROR: -sc already set to %.0f%%! Don't specify more than once!\n",system_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    system_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -sc %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_critical%%=%.0f\n",system_critical_pct); }
-	    } else {
-		    if ( system_critical != 0 ) {
-			    printf("ERROR: -sc set to %.1f! Don't specify more than once!\n",system_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    system_critical=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -sc %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_critical=%.1f\n",system_critical); }
-	    } 
+	    parse_threshold("sc", optarg, FALSE, &system_critical, &system_critical_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'g':
-	    /* if (verbose) { printf("Option system-free-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( system_free_critical_pct != 0 ) {
-			    printf("ERROR: -sfc already set to %.0f%%! Don't specify more than once!\n",system_free_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    system_free_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: Argument %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_free_critical%%=%.0f\n",system_free_critical_pct); }
-	    } else {
-		    if ( system_free_critical != 0 ) {
-			    printf("ERROR: -sfc already set to %.1f! Don't specify more than once!\n",system_free_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    system_free_critical=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -sfc %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_free_critical=%.1f\n",system_free_critical); }
-	    } 
+	    parse_threshold("sfc", optarg, TRUE, &system_free_critical, &system_free_critical_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'k':
-	    /* if (verbose) { printf("Option system-free-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( system_free_warning_pct != 0 ) {
-			    printf("ERROR: -sfw already set to %.0f%%! Don't specify more than once!\n",system_free_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    system_free_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -sfw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_free_warning%%=%.0f\n",system_free_warning_pct); }
-	    } else {
-		    if ( system_free_warning != 0 ) {
-			    printf("ERROR: -sfw already set to %.1f! Don't specify more than once!\n",system_free_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    system_free_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -sfw %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_free_warning=%.1f\n",system_free_warning); }
-	    } 
+	    parse_threshold("sfw", optarg, TRUE, &system_free_warning, &system_free_warning_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'h':
 	    print_help();
@@ -724,6 +667,25 @@ int main(int argc, char* argv[])
 				exit(STATE_UNKNOWN);
 	    }
 	    break;
+    	case OPT_SHM:
+	    shm_client=TRUE;
+	    break;
+    	case OPT_VCSW_WARNING:
+	    parse_threshold("-vcsw-invol-warning", optarg, FALSE, &vcsw_invol_warning, NULL);
+	    break;
+    	case OPT_VCSW_CRITICAL:
+	    parse_threshold("-vcsw-invol-critical", optarg, FALSE, &vcsw_invol_critical, NULL);
+	    break;
+    	case OPT_WINDOW:
+	    for (shm_window = 1; shm_window < SHM_WINDOWS; shm_window++)
+		    if (strcmp(optarg, shm_window_names[shm_window]) == 0)
+			    break;
+	    if (shm_window == SHM_WINDOWS) {
+		    printf("ERROR: Invalid window: %s! Allowed are 1m, 5m, 15m!\n",optarg);
+		    print_usage();
+		    exit(STATE_UNKNOWN);
+	    }
+	    break;
     	case 'x':
 	    /* if (verbose) { printf("Option strict selected\n"); } */
 	    strict=TRUE;
@@ -736,17 +698,25 @@ int main(int argc, char* argv[])
     	}
     }
 
+    if (shm_window && !shm_client) {
+	    printf("ERROR: --window needs --shm!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
     /* check if either one monitor option is used
      * you can mix as many options as you want... even if it doesn't make sense at all */
-    if ( pool_critical + pool_warning +
-		    pool_critical_pct + pool_warning_pct +
-		    pool_free_critical + pool_free_warning +
-		    pool_free_critical_pct + pool_free_warning_pct +
-		    system_critical + system_warning +
-		    system_critical_pct + system_warning_pct +
-		    system_free_critical + system_free_warning +
-		    system_free_critical_pct + system_free_warning_pct == 0 ) {
-	    printf("ERROR: Specify at least on option -pw, -pc, -pfw, -pfc, -sw, -sc, -sfw, -sfc!\n");
+    if ( pool_critical.set + pool_warning.set +
+		    pool_critical_pct.set + pool_warning_pct.set +
+		    pool_free_critical.set + pool_free_warning.set +
+		    pool_free_critical_pct.set + pool_free_warning_pct.set +
+		    system_critical.set + system_warning.set +
+		    system_critical_pct.set + system_warning_pct.set +
+		    system_free_critical.set + system_free_warning.set +
+		    system_free_critical_pct.set + system_free_warning_pct.set +
+		    vcsw_invol_warning.set + vcsw_invol_critical.set == 0 ) {
+	    printf("ERROR: Specify at least on option -pw, -pc, -pfw, -pfc, -sw, -sc, -sfw, -sfc,\n");
+	    printf("       --vcsw-invol-warning, --vcsw-invol-critical!\n");
 	    print_usage();
 	    exit(STATE_UNKNOWN);
     }
@@ -754,40 +724,32 @@ int main(int argc, char* argv[])
     /* 2 structures for difference calculation */
     perfstat_partition_total_t last_lparstats, lparstats;
 
-    /* API variables and helpers */
-    u_longlong_t last_time_base;
-    u_longlong_t last_pool_busy_time, last_shcpu_busy_time;
-    u_longlong_t last_pool_idle_time = 0;
-
-    u_longlong_t dlt_pool_busy_time, dlt_shcpu_busy_time;
-    u_longlong_t delta_time_base;
-    u_longlong_t shcpus_in_sys=0;
-    double pool_busy_time=0, pool_busy_time_pct=0, shcpu_busy_time=0, shcpu_busy_time_pct=0;
-    double shcpu_free_time=0, shcpu_free_time_pct=0;
-    double pool_free_time=0, pool_free_time_pct=0;
-    int pool_id;
-    int phys_cpus_pool=0;
-
-    /* retrieve the logical partition metrics */
-    if (!perfstat_partition_total(NULL, &last_lparstats, sizeof(perfstat_partition_total_t), 1)) {
-        	printf("CPU_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+    if (shm_client) {
+	/* results of the sampler daemon */
+	read_shm_snapshot();
+    } else {
+	/* retrieve the logical partition metrics */
+	if (!perfstat_partition_total(NULL, &last_lparstats, sizeof(perfstat_partition_total_t), 1)) {
+		printf("CPU_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
 		exit(STATE_UNKNOWN);
+	}
+	lpar_type = last_lparstats.type;
     }
 
     /* Bail out when any pool monitoring is requested and there is no
      * pool authority enabled (HMC -> LPAR-name -> Enable performance collection
      * or from hmc command line: chsyscfg -m msys -r LPAR  -i "LPAR _id=XX,allow_perf_collection=1" */
-    if (pool_check_requested && last_lparstats.type.b.shared_enabled && !last_lparstats.type.b.pool_util_authority) {
+    if (pool_check_requested && lpar_type.b.shared_enabled && !lpar_type.b.pool_util_authority) {
 	    printf("CPU_POOLS CRITICAL Performance collection is disabled in LPAR profile! Monitoring is not possible!\n");
 	    exit(STATE_CRITICAL);
     }
 
     /* are we dedicated donating? */
-    if(last_lparstats.type.b.donate_enabled)
+    if(lpar_type.b.donate_enabled)
 	dedicated_donating = 1;
 
     /* No entitlement and pool data on dedicated LPARs */
-    if ( ! dedicated_donating && ! last_lparstats.type.b.shared_enabled ) {
+    if ( ! dedicated_donating && ! lpar_type.b.shared_enabled ) {
     	printf("CPU_POOLS UNKNOWN Entitlement and pool data not available in dedicated LPAR mode\n");
 	exit(STATE_UNKNOWN);
     }
@@ -799,94 +761,78 @@ int main(int argc, char* argv[])
 	exit(STATE_UNKNOWN);
     }
 
-    sleep(interval);
+    if (!shm_client) {
+	sleep(interval);
 
-    /* retrieve the logical partition metrics... again */
-    if (!perfstat_partition_total(NULL, &lparstats, sizeof(perfstat_partition_total_t), 1)) {
-        	printf("CPU_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+	/* retrieve the logical partition metrics... again */
+	if (!perfstat_partition_total(NULL, &lparstats, sizeof(perfstat_partition_total_t), 1)) {
+		printf("CPU_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
 		exit(STATE_UNKNOWN);
-    }
-    /* delta pool usage values */
-    dlt_pool_busy_time = lparstats.pool_busy_time - last_lparstats.pool_busy_time;
-    dlt_shcpu_busy_time = lparstats.shcpu_busy_time - last_lparstats.shcpu_busy_time;
-
-    /* get pool sizes */
-    phys_cpus_pool = lparstats.phys_cpus_pool;
-    shcpus_in_sys = lparstats.shcpus_in_sys;
+	}
 
-    /* pool id of this lpar */
-    pool_id = lparstats.pool_id;
+	calculate_values(&last_lparstats, &lparstats);
+    }
 
-    /* new delta timer */
-    delta_time_base = lparstats.timebase_last - last_lparstats.timebase_last;
+    if ((vcsw_invol_warning.set || vcsw_invol_critical.set) && !vcsw_available) {
+	printf("CPU_POOLS UNKNOWN vcsw_invol is not available%s!\n", shm_client ? " with --shm" : "");
+	exit(STATE_UNKNOWN);
+    }
 
     /* we run in shared LPAR mode? */
-    if (lparstats.type.b.shared_enabled) {
-
-        /* Shared LPAR with pool authority enabled -> we have pool data */
-        if (lparstats.type.b.pool_util_authority) {
-        /* Available Pool Processor (app) */
-	   pool_free_time=(double)(lparstats.pool_idle_time - last_lparstats.pool_idle_time) / (XINTFRAC*(double)delta_time_base);
-	   pool_free_time_pct=pool_free_time*100/phys_cpus_pool;
-
-           /* busy CPUs in Pool = phys_cpus_pool - app */
-	   pool_busy_time=(double)dlt_pool_busy_time/(XINTFRAC*(double)delta_time_base);
-	   pool_busy_time_pct= pool_busy_time * 100 / phys_cpus_pool;
-
-           /* busy CPUs in managed system = Shared Pool 0 usage */
-	   shcpu_busy_time=(double)dlt_shcpu_busy_time/(XINTFRAC*(double)delta_time_base);
-	   shcpu_busy_time_pct=shcpu_busy_time * 100 / (double)shcpus_in_sys;
-	   /* free CPUs in managed system = busy CPUs - shcpus_in_sys */
-	   shcpu_free_time=shcpus_in_sys - shcpu_busy_time;
-	   shcpu_free_time_pct=shcpu_free_time * 100 / (double)shcpus_in_sys;
-        }
+    if (lpar_type.b.shared_enabled) {
 
 	/* Compare critical and warning values */
 	
 	/* Pool usage */
-	temp_state=get_new_status("Pool usage percentage check", pool_busy_time_pct, pool_warning_pct, pool_critical_pct);
+	temp_state=get_range_status("Pool usage percentage check", pool_busy_time_pct, &pool_warning_pct, &pool_critical_pct);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	pool_state = max_state(pool_state, temp_state);			/* pool monitor state */
 
-	temp_state=get_new_status("Pool usage check", pool_busy_time, pool_warning, pool_critical);
+	temp_state=get_range_status("Pool usage check", pool_busy_time, &pool_warning, &pool_critical);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	pool_state = max_state(pool_state, temp_state);			/* pool monitor state */
 	
 	/* Pool free */
-	temp_state=get_new_lower_status("Pool free percentage check", pool_free_time_pct, pool_free_warning_pct, pool_free_critical_pct);
+	temp_state=get_range_status("Pool free percentage check", pool_free_time_pct, &pool_free_warning_pct, &pool_free_critical_pct);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	pool_free_state = max_state(pool_free_state, temp_state);	/* pool free monitor state */
 
-	temp_state=get_new_lower_status("Pool free check", pool_free_time, pool_free_warning, pool_free_critical);
+	temp_state=get_range_status("Pool free check", pool_free_time, &pool_free_warning, &pool_free_critical);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	pool_free_state = max_state(pool_free_state, temp_state);	/* pool free monitor state */
 
 	/* System pool usage */
-	temp_state=get_new_status("System pool usage percentage check", shcpu_busy_time_pct, system_warning_pct, system_critical_pct);
+	temp_state=get_range_status("System pool usage percentage check", shcpu_busy_time_pct, &system_warning_pct, &system_critical_pct);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	syspool_state = max_state(syspool_state, temp_state);		/* system pool state */
 
-	temp_state=get_new_status("System pool usage check", shcpu_busy_time, system_warning, system_critical);
+	temp_state=get_range_status("System pool usage check", shcpu_busy_time, &system_warning, &system_critical);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	syspool_state = max_state(syspool_state, temp_state);		/* system pool state */
 
 	/* System pool free */
-	temp_state=get_new_lower_status("System pool free percentage check", shcpu_free_time_pct, system_free_warning_pct, system_free_critical_pct);
+	temp_state=get_range_status("System pool free percentage check", shcpu_free_time_pct, &system_free_warning_pct, &system_free_critical_pct);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	syspool_free_state = max_state(syspool_free_state, temp_state);	/* system pool free state */
 
-	temp_state=get_new_lower_status("System pool free check", shcpu_free_time, system_free_warning, system_free_critical);
+	temp_state=get_range_status("System pool free check", shcpu_free_time, &system_free_warning, &system_free_critical);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	syspool_free_state = max_state(syspool_free_state, temp_state);	/* system pool free state */
 
+	/* involuntary virtual context switches */
+	temp_state=get_range_status("Involuntary virtual context switch check", vcsw_invol, &vcsw_invol_warning, &vcsw_invol_critical);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	vcsw_state = max_state(vcsw_state, temp_state);			/* virtual context switch state */
+
 	/* when strict checking enabled, do sanity checks too */
 	if (strict) {
 		if ( phys_cpus_pool == 0 ||
@@ -926,7 +872,7 @@ int main(int argc, char* argv[])
 
 	}
 
-	printf("CPU_POOLS %s pool_id=%d pool_size=%d pool_used=%.2f(%s) pool_free=%.2f(%s) syspool_size=%llu syspool_used=%.2f(%s) syspool_free=%.2f(%s) |pool_id=%d pool_size=%d pool_used=%.2f pool_free=%.2f syspool_size=%llu syspool_used=%.2f syspool_free=%.2f\n",
+	printf("CPU_POOLS %s pool_id=%d pool_size=%d pool_used=%.2f(%s) pool_free=%.2f(%s) syspool_size=%llu syspool_used=%.2f(%s) syspool_free=%.2f(%s)%s |pool_id=%d pool_size=%d pool_used=%.2f pool_free=%.2f syspool_size=%llu syspool_used=%.2f syspool_free=%.2f%s\n",
 			states[ent_pool_state],
 			pool_id,
 			phys_cpus_pool,
@@ -939,13 +885,15 @@ int main(int argc, char* argv[])
 			states[syspool_state],
 			shcpu_free_time,
 			states[syspool_free_state],
+			vcsw_status(),
 			pool_id,
 			phys_cpus_pool,
 			pool_busy_time,
 			pool_free_time,
 			shcpus_in_sys,
 			shcpu_busy_time,
-			shcpu_free_time
+			shcpu_free_time,
+			vcsw_perfdata()
 			);
 
 	exit(ent_pool_state);
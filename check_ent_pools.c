@@ -21,8 +21,21 @@ const char *version = "1.4";
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <errno.h>
 #include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/sched.h>
+#include <sys/processor.h>
 #include <libperfstat.h>
 
 #ifndef XINTFRAC		/* for timebase calculations... */
@@ -46,6 +59,34 @@ enum {
 /* string representations of the return codes */
 char *states[5]={"OK","WARNING","CRITICAL","UNKNOWN","DEPENDENT"};
 
+/* layout and reader of the sampler daemon snapshot */
+#include "shm_snapshot.h"
+
+/* getopt return values of long options without a single character equivalent */
+enum {
+	OPT_STATE_FILE = 256,
+	OPT_STATE_MAX_AGE,
+	OPT_DAEMON,
+	OPT_SHM,
+	OPT_WINDOW,
+	OPT_SAMPLE_MS,
+	OPT_STATISTIC,
+	OPT_STREAM,
+	OPT_COUNT,
+	OPT_ADAPTIVE,
+	OPT_ALIGN,
+	OPT_TIMEOUT,
+	OPT_REALTIME,
+	OPT_BIND,
+	OPT_CPU_SCAN,
+	OPT_SCALED,
+	OPT_TOP,
+	OPT_WPAR,
+	OPT_WPAR_WARNING,
+	OPT_WPAR_CRITICAL,
+	OPT_METRIC = 512	/* OPT_METRIC + 2 * metric is the warning, + 1 the critical threshold of a metric */
+};
+
 /* initial state values */
 int ent_pool_state=STATE_OK, temp_state=STATE_OK;
 int vcpu_busy_state=STATE_OK;
@@ -58,19 +99,277 @@ int interval=1;			/* default interval in seconds between the 2 perflib calls = m
 int verbose=FALSE;		/* only 1 verbose level... violating the plugin recommendations here */
 int strict=FALSE;		/* additional sanity checking of various system values */
 int pool_check_requested=0;	/* indicator for pool check requests, to react properly when there are no pools to check */
+char *state_file=NULL;		/* file keeping the counters of the last run, no sleep needed when set and valid */
+int state_max_age=300;		/* maximum age in seconds of the counters in the state file */
+int daemon_mode=FALSE;		/* run as sampler daemon publishing the results in shared memory */
+int shm_client=FALSE;		/* take the results from the sampler daemon instead of sampling */
+int shm_window=0;		/* window of the sampler daemon results, 0 is its sampling interval */
+int sample_ms=0;		/* high-frequency sampling: length of one slice of the interval in milliseconds */
+double statistic=0;		/* percentile of the slices used for the checks, 0 is the mean of the interval */
+int adaptive=FALSE;		/* stop sampling as soon as all threshold results are settled */
+int align=FALSE;		/* start the measurement period at a multiple of interval of the wall clock */
+double align_start=0;		/* wall clock time of the first sample */
+int timeout=0;			/* seconds until the check has to return, 0 is no limit */
+double deadline=0;		/* wall clock time the measurement has to end, 0 is no limit */
+int shortened=FALSE;		/* the measurement period was cut at the deadline */
+int realtime=FALSE;		/* daemon and stream: fixed high priority and locked memory */
+int bind_cpu=-1;		/* daemon and stream: logical CPU to bind to, -1 is no binding */
+double wakeup_late=0;		/* lateness of the last wake-up from sleep_until in seconds */
+double wakeup_late_max=0;	/* maximum lateness since reset by the caller */
+double sampler_late=0, sampler_late_max=0;	/* wake-up lateness of the sampler daemon */
+int stream_count=-1;		/* streaming: number of intervals to print, 0 is endless, -1 is a single check */
+int scaled=FALSE;		/* entitlement checks on the frequency scaled consumption (SPURR) */
+
+/* nagios plugin threshold ranges */
+#include "nagios_range.h"
 
 /* monitoring variables */
-double entitlement_critical_pct=0, entitlement_warning_pct=0;
-double entitlement_critical=0, entitlement_warning=0;
-double vcpu_busy_critical_pct=0, vcpu_busy_warning_pct=0;
-double pool_critical_pct=0, pool_warning_pct=0;
-double pool_critical=0, pool_warning=0;
-double pool_free_critical_pct=0, pool_free_warning_pct=0;
-double pool_free_critical=0, pool_free_warning=0;
-double system_critical_pct=0, system_warning_pct=0;
-double system_critical=0, system_warning=0;
-double system_free_critical_pct=0, system_free_warning_pct=0;
-double system_free_critical=0, system_free_warning=0;
+struct range entitlement_critical_pct, entitlement_warning_pct;
+struct range entitlement_critical, entitlement_warning;
+struct range vcpu_busy_critical_pct, vcpu_busy_warning_pct;
+struct range pool_critical_pct, pool_warning_pct;
+struct range pool_critical, pool_warning;
+struct range pool_free_critical_pct, pool_free_warning_pct;
+struct range pool_free_critical, pool_free_warning;
+struct range system_critical_pct, system_warning_pct;
+struct range system_critical, system_warning;
+struct range system_free_critical_pct, system_free_warning_pct;
+struct range system_free_critical, system_free_warning;
+
+/* per-slice values of the high-frequency sampling, ring buffer */
+#define MAX_SLICES	3000	/* 30 seconds in 10 ms slices */
+
+struct slice_ring {
+	int count;		/* number of valid slices */
+	int next;		/* slot of the next slice */
+	double phys_proc_consumed[MAX_SLICES];
+	double pool_busy_time[MAX_SLICES];
+	double pool_free_time[MAX_SLICES];
+} slices;
+
+/* per logical CPU scan with perfstat_cpu, PURR counters at the start and the end of the measurement period
+ * perfstat fills an array of structures, the counters are copied into a structure of arrays so the
+ * reduction runs over contiguous counters and the compiler can vectorize it */
+int cpu_scan=FALSE;
+perfstat_cpu_t *cpu_buffer;	/* output of perfstat_cpu */
+int cpu_buffer_size=0;		/* number of logical CPUs it can take */
+int lcpus_online=0;		/* online logical CPUs from perfstat_cpu_total, SMT threads of all vCPUs */
+double *cpu_busy;		/* busy percentage of every logical CPU over the measurement period */
+
+struct cpu_counters {
+	int count;		/* number of logical CPUs */
+	int *id;		/* logical CPU number from the perfstat name cpuN */
+	u_longlong_t *busy;	/* puser + psys */
+	u_longlong_t *total;	/* puser + psys + pidle + pwait */
+} cpu_start, cpu_end;
+
+/* run queue and swap queue with perfstat_cpu_total, with --cpu-scan or a run queue threshold */
+int runq_scan=FALSE;
+
+struct runq_counters {
+	u_longlong_t runque, swpque;	/* accumulated by the kernel once per second */
+	int ncpus;			/* online logical CPUs */
+} runq_start, runq_end;
+
+/* attribution of the consumption to processes with perfstat_process, output of non OK checks only */
+#define TOP_MAX		20
+int top_count=0;		/* number of top consumers, 0 is no attribution */
+
+struct proc_snapshot {
+	int count;		/* number of processes */
+	int size;		/* number of processes the buffer can take */
+	perfstat_process_t *procs;
+} proc_start, proc_end;
+
+/* min-heap of the top consumers, the root is the smallest of the top_count largest */
+struct consumer {
+	double cpu;		/* CPUs consumed over the measurement period */
+	perfstat_process_t *proc;
+} top[TOP_MAX];
+int top_used=0;
+
+/* consumption of the workload partitions with perfstat_wpar_total and perfstat_cpu_total_wpar */
+int wpar_mode=FALSE;
+
+struct wpar_snapshot {
+	int count;		/* number of WPARs */
+	int size;		/* number of WPARs the buffers can take */
+	perfstat_wpar_total_t *wpars;
+	u_longlong_t *busy;	/* puser + psys of the WPAR */
+} wpar_start, wpar_end;
+
+/* results of the WPARs of the end snapshot, valid when the WPAR was in the start snapshot too */
+struct wpar_result {
+	int valid;
+	double used;		/* physical CPUs consumed */
+	double ent_share;	/* percentage of the entitlement of the LPAR */
+	int state;
+} *wpar_results;
+
+/* thresholds per WPAR name, "*" applies to all WPARs without own thresholds */
+#define WPAR_THRESHOLDS	64
+
+struct wpar_threshold {
+	char name[MAXCORRALNAMELEN+1];
+	struct range warning, critical;		/* CPUs */
+	struct range warning_pct, critical_pct;	/* percentage of the entitlement of the LPAR */
+} wpar_thresholds[WPAR_THRESHOLDS];
+int wpar_threshold_count=0;
+
+/* monitoring results, calculated from 2 perfstat samples or taken from the sampler daemon */
+perfstat_partition_type_t lpar_type;
+u_longlong_t shcpus_in_sys=0;
+double pool_busy_time=0, pool_busy_time_pct=0, shcpu_busy_time=0, shcpu_busy_time_pct=0;
+double shcpu_free_time=0, shcpu_free_time_pct=0;
+double pool_free_time=0, pool_free_time_pct=0;
+double phys_proc_consumed=0, entitlement=0, percent_ent=0, vcpu_busy=0;
+int pool_id;
+int phys_cpus_pool=0;
+int max_entitlement=0;
+double window=0;		/* length of the measurement period in seconds */
+
+/* additional metrics, always in the performance data and in the output when a threshold is set */
+enum {
+	M_PHYSC_USER,
+	M_PHYSC_SYS,
+	M_PHYSC_WAIT,
+	M_PHYSC_IDLE,
+	M_DONATED_IDLE,
+	M_DONATED_BUSY,
+	M_STOLEN_IDLE,
+	M_STOLEN_BUSY,
+	M_VCSW_VOL,
+	M_VCSW_INVOL,
+	M_HPI,
+	M_HPI_WAIT,
+	M_POOL_MAX_CAP,
+	M_POOL_RESERVED,
+	M_POOL_CAP_USED_PCT,
+	M_POOL_SHARE_PCT,
+	M_FAIR_SHARE,
+	M_FAIR_SHARE_EXCESS,
+	M_THROTTLED_PCT,
+	M_LCPU_BUSY_MAX,
+	M_LCPU_BUSY_MIN,
+	M_LCPU_BUSY_STDDEV,
+	M_LCPU_SATURATED,
+	M_VCPU_UNFOLDED,
+	M_VCPU_FOLDED,
+	M_SMT_SPREAD,
+	M_ENT_USED_SPURR,
+	M_FREQ_RATIO,
+	M_RUNQ,
+	M_RUNQ_VCPU,
+	M_RUNQ_LCPU,
+	M_SWPQ,
+	M_AME_PHYSC,
+	M_AME_ENT_PCT,
+	M_ENT_USED_APP,
+	M_AME_FACTOR,
+	M_AME_DEFICIT_MB,
+	M_IOME_USED_PCT,
+	M_IOME_HWM_PCT,
+	METRICS
+};
+
+struct metric {
+	char *name;		/* label in output and performance data */
+	char *option;		/* long option prefix of the thresholds */
+	int lower;		/* bare number thresholds are lower limits */
+	double value;
+	struct range warning, critical;
+	int available;		/* measured in the last calculation */
+	int state;
+} metrics[METRICS] = {
+	{ "physc_user", "physc-user" },
+	{ "physc_sys", "physc-sys" },
+	{ "physc_wait", "physc-wait" },
+	{ "physc_idle", "physc-idle" },
+	{ "donated_idle", "donated-idle" },
+	{ "donated_busy", "donated-busy" },
+	{ "stolen_idle", "stolen-idle" },
+	{ "stolen_busy", "stolen-busy" },
+	{ "vcsw_vol", "vcsw-vol" },
+	{ "vcsw_invol", "vcsw-invol" },
+	{ "hpi", "hpi" },
+	{ "hpi_wait", "hpi-wait" },
+	{ "pool_max_cap", "pool-max-cap" },
+	{ "pool_reserved", "pool-reserved" },
+	{ "pool_cap_used_pct", "pool-cap-used" },
+	{ "pool_share_pct", "pool-share" },
+	{ "fair_share", "fair-share" },
+	{ "fair_share_excess", "fair-share-excess" },
+	{ "throttled_pct", "throttled" },
+	{ "lcpu_busy_max", "lcpu-busy-max" },
+	{ "lcpu_busy_min", "lcpu-busy-min" },
+	{ "lcpu_busy_stddev", "lcpu-busy-stddev" },
+	{ "lcpu_saturated", "lcpu-saturated" },
+	{ "vcpu_unfolded", "vcpu-unfolded" },
+	{ "vcpu_folded", "vcpu-folded" },
+	{ "smt_spread", "smt-spread" },
+	{ "ent_used_spurr", "ent-used-spurr" },
+	{ "freq_ratio", "freq-ratio", TRUE },
+	{ "runq", "runq" },
+	{ "runq_vcpu", "runq-vcpu" },
+	{ "runq_lcpu", "runq-lcpu" },
+	{ "swpq", "swpq" },
+	{ "ame_physc", "ame-physc" },
+	{ "ame_ent_pct", "ame-ent" },
+	{ "ent_used_app", "ent-used-app" },
+	{ "ame_factor", "ame-factor" },
+	{ "ame_deficit_mb", "ame-deficit" },
+	{ "iome_used_pct", "iome-used" },
+	{ "iome_hwm_pct", "iome-hwm" }
+};
+int metric_check_requested=0;	/* number of thresholds set for additional metrics */
+
+/* long options of the warning and critical threshold of a metric */
+#define METRIC_OPTIONS(option, m) \
+	{option "-warning",  required_argument, 0, OPT_METRIC + 2 * (m)}, \
+	{option "-critical", required_argument, 0, OPT_METRIC + 2 * (m) + 1}
+
+void set_metric(int m, double value)
+{
+	metrics[m].value = value;
+	metrics[m].available = TRUE;
+}
+struct shm_window shm_windows[SHM_WINDOWS];	/* all results of the sampler daemon */
+
+/* sampler daemon: counters of the last 15 minutes at an interval of 1 second,
+ * the results over any window are the difference of two entries */
+#define WINDOW_RING	(900 + 1)
+
+perfstat_partition_total_t window_ring[WINDOW_RING];
+double late_ring[WINDOW_RING];		/* wake-up lateness of the samples in the ring */
+char gap_ring[WINDOW_RING];		/* the second ending with this sample is left out of the windows */
+long last_gap=-1;			/* step of the latest second marked in gap_ring */
+
+/* adaptive sampling: a check result is settled when the confidence interval of the mean of the slices
+ * contains neither the warning nor the critical threshold */
+#define ADAPTIVE_SAMPLE_MS	200	/* slice length when --sample-ms is not given */
+#define ADAPTIVE_MIN_SLICES	5	/* never decide on less slices */
+#define ADAPTIVE_Z		3.0	/* width of the confidence interval in standard errors */
+
+struct adaptive_metric {
+	double *value;
+	struct range *warning;
+	struct range *critical;
+	double sum;
+	double sumsq;
+} adaptive_metrics[] = {
+	{ &percent_ent, &entitlement_warning_pct, &entitlement_critical_pct },
+	{ &phys_proc_consumed, &entitlement_warning, &entitlement_critical },
+	{ &vcpu_busy, &vcpu_busy_warning_pct, &vcpu_busy_critical_pct },
+	{ &pool_busy_time_pct, &pool_warning_pct, &pool_critical_pct },
+	{ &pool_busy_time, &pool_warning, &pool_critical },
+	{ &pool_free_time_pct, &pool_free_warning_pct, &pool_free_critical_pct },
+	{ &pool_free_time, &pool_free_warning, &pool_free_critical },
+	{ &shcpu_busy_time_pct, &system_warning_pct, &system_critical_pct },
+	{ &shcpu_busy_time, &system_warning, &system_critical },
+	{ &shcpu_free_time_pct, &system_free_warning_pct, &system_free_critical_pct },
+	{ &shcpu_free_time, &system_free_warning, &system_free_critical }
+};
+#define ADAPTIVE_METRICS	(sizeof(adaptive_metrics) / sizeof(adaptive_metrics[0]))
 
 
 /* helper functions "stolen" from util.c and utilbase.c */
@@ -240,6 +539,1525 @@ int get_new_lower_status(char *verbose_message, double value, double warn, doubl
 	return state;
 }
 
+/* a given limit of the range is within distance of the value */
+int range_near(struct range *r, double value, double distance)
+{
+	return r->set && ((r->given_start && fabs(value - r->start) <= distance) ||
+			  (r->given_end && fabs(value - r->end) <= distance));
+}
+
+/* state file layout: header followed by the raw perfstat data of the last run */
+#define STATE_MAGIC	0x454e5450	/* "ENTP" */
+#define STATE_VERSION	1
+
+struct state_record {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int size;		/* sizeof(perfstat_partition_total_t) of the writer */
+	unsigned int checksum;		/* checksum of lparstats */
+	time_t saved;			/* wall clock time of the sample */
+	perfstat_partition_total_t lparstats;
+};
+
+/* Adler-32 of the saved counters, detects truncated or garbled state files */
+unsigned int state_checksum(perfstat_partition_total_t *lparstats)
+{
+	unsigned char *p = (unsigned char *)lparstats;
+	unsigned int a = 1, b = 0;
+	size_t i;
+
+	for (i = 0; i < sizeof(perfstat_partition_total_t); i++) {
+		a = (a + p[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	return (b << 16) | a;
+}
+
+/* wait for a lock on the whole state file, type is F_RDLCK or F_WRLCK */
+int lock_state_file(int fd, short type)
+{
+	struct flock lock;
+
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = 0;
+	lock.l_len = 0;
+	return fcntl(fd, F_SETLKW, &lock);
+}
+
+/* the state file has to be a regular file of the caller, a planted file or device is never used */
+int own_state_file(int fd, const char *file)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid()) {
+		if (verbose) { printf("State file %s is no regular file owned by uid %d, ignored\n", file, (int)getuid()); }
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* read the counters of the last run from the state file
+ * returns FALSE if there is no state file or it was written by an incompatible binary */
+int read_state_file(const char *file, perfstat_partition_total_t *lparstats, time_t *saved)
+{
+	struct state_record record;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(file, O_RDONLY | O_NOFOLLOW)) < 0) {
+		if (verbose) { printf("State file %s not readable: %s\n", file, strerror(errno)); }
+		return FALSE;
+	}
+	if (!own_state_file(fd, file)) {
+		close(fd);
+		return FALSE;
+	}
+	if (lock_state_file(fd, F_RDLCK) < 0) {
+		if (verbose) { printf("State file %s not lockable: %s\n", file, strerror(errno)); }
+		close(fd);
+		return FALSE;
+	}
+	n = read(fd, &record, sizeof(record));
+	close(fd);	/* releases the lock too */
+
+	if (n != sizeof(record) ||
+	    record.magic != STATE_MAGIC ||
+	    record.version != STATE_VERSION ||
+	    record.size != sizeof(perfstat_partition_total_t) ||
+	    record.checksum != state_checksum(&record.lparstats)) {
+		if (verbose) { printf("State file %s is invalid, ignored\n", file); }
+		return FALSE;
+	}
+	memcpy(lparstats, &record.lparstats, sizeof(perfstat_partition_total_t));
+	*saved = record.saved;
+	return TRUE;
+}
+
+/* save the counters of this run for the next one, errors only mean the next run has to sleep again */
+void write_state_file(const char *file, perfstat_partition_total_t *lparstats)
+{
+	struct state_record record;
+	int fd;
+
+	memset(&record, 0, sizeof(record));
+	record.magic = STATE_MAGIC;
+	record.version = STATE_VERSION;
+	record.size = sizeof(perfstat_partition_total_t);
+	record.saved = time(NULL);
+	memcpy(&record.lparstats, lparstats, sizeof(perfstat_partition_total_t));
+	record.checksum = state_checksum(&record.lparstats);
+
+	if ((fd = open(file, O_WRONLY | O_CREAT | O_NOFOLLOW, 0644)) < 0) {
+		if (verbose) { printf("State file %s not writable: %s\n", file, strerror(errno)); }
+		return;
+	}
+	if (!own_state_file(fd, file)) {
+		close(fd);
+		return;
+	}
+	if (lock_state_file(fd, F_WRLCK) < 0 ||
+	    pwrite(fd, &record, sizeof(record), 0) != sizeof(record) ||
+	    ftruncate(fd, sizeof(record)) < 0) {
+		if (verbose) { printf("State file %s not written: %s\n", file, strerror(errno)); }
+	}
+	close(fd);
+}
+
+/* clock readings in seconds before and after a perfstat call, the timebase of the sample lies in between */
+struct sample_clock {
+	double before, after;
+};
+
+/* monotonic clock in seconds, not affected by NTP steps */
+double monotonic(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+/* perfstat_partition_total with the monotonic clock around the call, a stalled call widens the bracket */
+int sample_partition(perfstat_partition_total_t *lparstats, struct sample_clock *clock)
+{
+	int rc;
+
+	clock->before = monotonic();
+	rc = perfstat_partition_total(NULL, lparstats, sizeof(perfstat_partition_total_t), 1);
+	clock->after = monotonic();
+	return rc;
+}
+
+/* check if two samples can be the start and the end of one measurement period
+ * the timebase delta has to lie between the shortest and the longest time the clock readings allow
+ * returns NULL or the reason why the deltas would be wrong */
+#define DISCONTINUITY_TOLERANCE	0.05	/* resolution of the timebase and the clock */
+
+char timebase_jump[] = "Timebase does not match wall clock";	/* counters are still continuous */
+
+char *sample_discontinuity(perfstat_partition_total_t *last, struct sample_clock *last_clock,
+			   perfstat_partition_total_t *now, struct sample_clock *now_clock)
+{
+	double elapsed;
+
+	/* reconfigured LPAR (DLPAR), the deltas would mix up different configurations */
+	if (last->lpar_id != now->lpar_id ||
+	    last->pool_id != now->pool_id ||
+	    last->type.b.shared_enabled != now->type.b.shared_enabled ||
+	    last->type.b.donate_enabled != now->type.b.donate_enabled ||
+	    last->type.b.capped != now->type.b.capped ||
+	    last->entitled_proc_capacity != now->entitled_proc_capacity ||
+	    last->online_cpus != now->online_cpus ||
+	    last->phys_cpus_pool != now->phys_cpus_pool ||
+	    last->shcpus_in_sys != now->shcpus_in_sys)
+		return "LPAR configuration changed";
+
+	/* counters going backwards mean reboot or partition mobility */
+	if (now->timebase_last <= last->timebase_last ||
+	    now->puser < last->puser || now->psys < last->psys ||
+	    now->pidle < last->pidle || now->pwait < last->pwait ||
+	    now->pool_busy_time < last->pool_busy_time ||
+	    now->pool_idle_time < last->pool_idle_time ||
+	    now->shcpu_busy_time < last->shcpu_busy_time)
+		return "Counters were reset";
+
+	/* timebase and clock have to agree, otherwise the timebase was not continuous (partition mobility) */
+	elapsed = (double)(now->timebase_last - last->timebase_last) * XINTFRAC / 1000000000.0;
+	if (elapsed < now_clock->before - last_clock->after - DISCONTINUITY_TOLERANCE ||
+	    elapsed > now_clock->after - last_clock->before + DISCONTINUITY_TOLERANCE)
+		return timebase_jump;
+
+	return NULL;
+}
+
+/* check if the saved counters can start the measurement period ending with the current counters
+ * returns the age of the saved counters in seconds or -1 when they are not usable */
+double state_age(perfstat_partition_total_t *saved, time_t saved_time, perfstat_partition_total_t *now)
+{
+	struct sample_clock saved_clock, now_clock;
+	double age;
+	char *reason;
+
+	/* wall clock in whole seconds, allows small NTP steps between the runs */
+	saved_clock.before = (double)saved_time - 1.0;
+	saved_clock.after = (double)saved_time + 1.0;
+	now_clock.before = (double)time(NULL) - 1.0;
+	now_clock.after = now_clock.before + 2.0;
+	if ((reason = sample_discontinuity(saved, &saved_clock, now, &now_clock))) {
+		if (verbose) { printf("%s since state file was written\n", reason); }
+		return -1;
+	}
+
+	age = (double)(now->timebase_last - saved->timebase_last) * XINTFRAC / 1000000000.0;
+	if (age > state_max_age) {
+		if (verbose) { printf("State file is %.0f seconds old, maximum is %d\n", age, state_max_age); }
+		return -1;
+	}
+	return age;
+}
+
+/* sleep with sub-second resolution */
+void sleep_seconds(double seconds)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)seconds;
+	ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1000000000.0);
+	while (nanosleep(&ts, &ts) < 0 && errno == EINTR)
+		;
+}
+
+/* current wall clock time in seconds */
+double wallclock(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+/* sleep until the wall clock reaches t
+ * in aligned mode the last milliseconds are spent polling the clock, AIX timers have a 10ms resolution */
+#define ALIGN_SPIN	0.01
+
+void sleep_until(double t)
+{
+	double wait = t - wallclock();
+
+	if (!align) {
+		if (wait > 0)
+			sleep_seconds(wait);
+	} else {
+		if (wait > ALIGN_SPIN)
+			sleep_seconds(wait - ALIGN_SPIN);
+		while (wallclock() < t)
+			;
+	}
+
+	/* oversleeping shows how starved the monitor is */
+	wakeup_late = wallclock() - t;
+	if (wakeup_late < 0)
+		wakeup_late = 0;
+	if (wakeup_late > wakeup_late_max)
+		wakeup_late_max = wakeup_late;
+}
+
+/* keep sampling in time on a saturated LPAR: bound to one logical CPU, fixed priority above all
+ * user processes, all memory locked and touched before the first sample, needs root */
+#define REALTIME_PRIORITY	50
+
+void make_realtime(void)
+{
+	if (bind_cpu >= 0 && bindprocessor(BINDPROCESS, getpid(), bind_cpu) != 0) {
+		printf("ENT_POOLS UNKNOWN Cannot bind to logical CPU %d: %s\n", bind_cpu, strerror(errno));
+		exit(STATE_UNKNOWN);
+	}
+	if (!realtime)
+		return;
+	if (setpri(0, REALTIME_PRIORITY) < 0) {
+		printf("ENT_POOLS UNKNOWN Cannot set fixed priority %d: %s\n", REALTIME_PRIORITY, strerror(errno));
+		exit(STATE_UNKNOWN);
+	}
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+		printf("ENT_POOLS UNKNOWN Cannot lock memory: %s\n", strerror(errno));
+		exit(STATE_UNKNOWN);
+	}
+	memset(window_ring, 0, sizeof(window_ring));
+	memset(late_ring, 0, sizeof(late_ring));
+	memset(gap_ring, 0, sizeof(gap_ring));
+	memset(&slices, 0, sizeof(slices));
+}
+
+/* the measurement has to end before nagios kills the check, the rest of the time is reserved for
+ * the output, the alarm is the last resort when perfstat hangs */
+#define TIMEOUT_MARGIN	1.0
+#define TIMEOUT_ALARM	0.25
+
+void timeout_handler(int sig)
+{
+	const char msg[] = "ENT_POOLS UNKNOWN Measurement did not finish before the timeout\n";
+
+	write(STDOUT_FILENO, msg, sizeof(msg) - 1);
+	_exit(STATE_UNKNOWN);
+}
+
+void set_deadline(void)
+{
+	struct itimerval alarm_time;
+
+	deadline = wallclock() + timeout - TIMEOUT_MARGIN;
+
+	memset(&alarm_time, 0, sizeof(alarm_time));
+	alarm_time.it_value.tv_sec = (int)(timeout - TIMEOUT_ALARM);
+	alarm_time.it_value.tv_usec = (int)((timeout - TIMEOUT_ALARM - alarm_time.it_value.tv_sec) * 1000000);
+	signal(SIGALRM, timeout_handler);
+	setitimer(ITIMER_REAL, &alarm_time, NULL);
+}
+
+/* end of the measurement period at the latest at the deadline */
+double period_end(double end)
+{
+	if (deadline && end > deadline) {
+		if (verbose && !shortened) { printf("Measurement period shortened by %.3f seconds at the deadline\n", end - deadline); }
+		shortened = TRUE;
+		return deadline;
+	}
+	return end;
+}
+
+/* aligned mode: wait for the next multiple of interval seconds of the wall clock */
+void wait_for_boundary(void)
+{
+	align_start = (floor(wallclock() / interval) + 1) * interval;
+	if (deadline && align_start >= deadline) {
+		/* no time to wait, the whole measurement would be lost */
+		if (verbose) { printf("Next interval boundary is after the deadline, not aligned\n"); }
+		align_start = wallclock();
+		return;
+	}
+	sleep_until(align_start);
+	if (verbose) { printf("Aligned start %.6f seconds late\n", wallclock() - align_start); }
+}
+
+/* uncapped weight of the other LPARs in the pool, the hypervisor does not tell us their weights */
+#define DEFAULT_WEIGHT	128
+
+/* projected entitlement of this LPAR when the pool is fully contended: the entitlement plus the
+ * share of the unreserved pool capacity, which the hypervisor distributes by uncapped weight.
+ * The other LPARs are assumed to have the default weight and to compete in proportion to their
+ * entitlement. */
+double fair_share(perfstat_partition_total_t *now, double capacity)
+{
+    double reserved, unreserved, share;
+
+    if (now->type.b.capped || now->var_proc_capacity_weight == 0)
+	return entitlement;
+
+    reserved = (double)now->entitled_pool_capacity / 100.0;
+    if (reserved < entitlement)
+	reserved = entitlement;
+    unreserved = capacity > reserved ? capacity - reserved : 0;
+
+    share = entitlement + unreserved * entitlement / reserved *
+	    (double)now->var_proc_capacity_weight / DEFAULT_WEIGHT;
+    return share < max_entitlement ? share : (double)max_entitlement;
+}
+
+/* calculate the monitoring results from the counters at the start (last) and the end (now)
+ * of the measurement period */
+void calculate_values(perfstat_partition_total_t *last, perfstat_partition_total_t *now)
+{
+    u_longlong_t dlt_pcpu_user, dlt_pcpu_sys, dlt_pcpu_idle, dlt_pcpu_wait;
+    u_longlong_t dlt_pool_busy_time, dlt_shcpu_busy_time;
+    u_longlong_t delta_time_base;
+    u_longlong_t delta_purr, delta_spurr;
+    int m;
+
+    /* LPAR mode at the end of the measurement period */
+    lpar_type = now->type;
+
+    /* additional metrics of this LPAR mode are set below */
+    for (m = 0; m < METRICS; m++)
+	metrics[m].available = FALSE;
+
+    /* all last_* values were set in the previous run, the deltas is what we want */
+    /* physc consists of usr+sys+wait+idle  */
+    dlt_pcpu_user  = now->puser - last->puser;
+    dlt_pcpu_sys   = now->psys  - last->psys;
+    dlt_pcpu_idle  = now->pidle - last->pidle;
+    dlt_pcpu_wait  = now->pwait - last->pwait;
+
+    delta_purr = dlt_pcpu_user + dlt_pcpu_sys + dlt_pcpu_idle + dlt_pcpu_wait;
+
+    /* delta pool usage values */
+    dlt_pool_busy_time = now->pool_busy_time - last->pool_busy_time;
+    dlt_shcpu_busy_time = now->shcpu_busy_time - last->shcpu_busy_time;
+
+    /* get pool sizes */
+    phys_cpus_pool = now->phys_cpus_pool;
+    shcpus_in_sys = now->shcpus_in_sys;
+
+    /* pool id of this lpar */
+    pool_id = now->pool_id;
+
+    /* get entitlement of lpar */
+    entitlement = (double)now->entitled_proc_capacity / 100.0 ;
+
+    /* get number of virtual processors = maximum entitlement */
+    max_entitlement = now->online_cpus;
+
+    /* new delta timer */
+    delta_time_base = now->timebase_last - last->timebase_last;
+    window = XINTFRAC * (double)delta_time_base / 1000000000.0;
+
+    /* Physical Processor Consumed = Entitlement Consumed */
+    phys_proc_consumed = (double)delta_purr / (double)delta_time_base;
+
+    /* frequency scaled consumption (SPURR), in power saving and dynamic performance modes PURR
+     * over- or understates the capacity used, the ratio is the effective frequency */
+    if (now->spurrflag) {
+	delta_spurr = (now->puser_spurr - last->puser_spurr) + (now->psys_spurr - last->psys_spurr) +
+		      (now->pidle_spurr - last->pidle_spurr) + (now->pwait_spurr - last->pwait_spurr);
+	set_metric(M_ENT_USED_SPURR, (double)delta_spurr / (double)delta_time_base);
+	if (delta_purr)
+	    set_metric(M_FREQ_RATIO, (double)delta_spurr / (double)delta_purr);
+	if (scaled)
+	    phys_proc_consumed = metrics[M_ENT_USED_SPURR].value;
+    }
+
+    /* Physical Processor Consumed by class */
+    set_metric(M_PHYSC_USER, (double)dlt_pcpu_user / (double)delta_time_base);
+    set_metric(M_PHYSC_SYS, (double)dlt_pcpu_sys / (double)delta_time_base);
+    set_metric(M_PHYSC_WAIT, (double)dlt_pcpu_wait / (double)delta_time_base);
+    set_metric(M_PHYSC_IDLE, (double)dlt_pcpu_idle / (double)delta_time_base);
+
+    /* Dedicated LPAR: idle cycles given to the shared pool (donating) and cycles taken by the hypervisor */
+    if (!now->type.b.shared_enabled) {
+	set_metric(M_DONATED_IDLE, (double)(now->idle_donated_purr - last->idle_donated_purr) / (double)delta_time_base);
+	set_metric(M_DONATED_BUSY, (double)(now->busy_donated_purr - last->busy_donated_purr) / (double)delta_time_base);
+	set_metric(M_STOLEN_IDLE, (double)(now->idle_stolen_purr - last->idle_stolen_purr) / (double)delta_time_base);
+	set_metric(M_STOLEN_BUSY, (double)(now->busy_stolen_purr - last->busy_stolen_purr) / (double)delta_time_base);
+    }
+
+    /* virtual context switches per vCPU and second, involuntary ones are hypervisor preemptions */
+    set_metric(M_VCSW_VOL, (double)(now->vol_virt_cswitch - last->vol_virt_cswitch) / window / (double)max_entitlement);
+    set_metric(M_VCSW_INVOL, (double)(now->invol_virt_cswitch - last->invol_virt_cswitch) / window / (double)max_entitlement);
+
+    /* Active Memory Sharing: hypervisor page-ins per second and average wait per page-in in ms,
+     * memory overcommit stalls the LPAR like a CPU shortage */
+    if (now->type.b.ams_enabled) {
+	set_metric(M_HPI, (double)(now->hpi - last->hpi) / window);
+	set_metric(M_HPI_WAIT, now->hpi == last->hpi ? 0.0 :
+		   (double)(now->hpit - last->hpit) / (double)(now->hpi - last->hpi) / 1000000.0);
+    }
+
+    /* Active Memory Expansion: CPUs spent on compression, part of ent_used, and the memory the
+     * expansion factor can't deliver (memory sizes are in 4 KB pages) */
+    if (now->type.b.ame_enabled) {
+	set_metric(M_AME_PHYSC, (double)(now->cmcs_total_time - last->cmcs_total_time) / (XINTFRAC*(double)delta_time_base));
+	if (phys_proc_consumed > 0)
+	    set_metric(M_AME_ENT_PCT, metrics[M_AME_PHYSC].value * 100 / phys_proc_consumed);
+	set_metric(M_ENT_USED_APP, phys_proc_consumed - metrics[M_AME_PHYSC].value);
+	set_metric(M_AME_FACTOR, (double)now->current_memexp_factr / 100.0);
+	set_metric(M_AME_DEFICIT_MB, (double)now->ame_deficit_size * 4 / 1024);
+    }
+
+    /* Active Memory Sharing: usage and high water mark of the I/O entitled memory */
+    if (now->type.b.ams_enabled && now->IOMemEntInUse + now->IOMemEntFree > 0) {
+	set_metric(M_IOME_USED_PCT, (double)now->IOMemEntInUse * 100 / (double)(now->IOMemEntInUse + now->IOMemEntFree));
+	set_metric(M_IOME_HWM_PCT, (double)now->IOHighWaterMark * 100 / (double)(now->IOMemEntInUse + now->IOMemEntFree));
+    }
+
+    /* Percentage of Entitlement Consumed */
+    percent_ent = (phys_proc_consumed / entitlement) * 100;
+
+    /* Percentage of vCPU busy */ 
+    vcpu_busy = (phys_proc_consumed / (double)max_entitlement) * 100;
+
+    /* Shared LPAR with pool authority enabled -> we have pool data */
+    if (now->type.b.shared_enabled && now->type.b.pool_util_authority) {
+        /* Available Pool Processor (app) */
+	pool_free_time=(double)(now->pool_idle_time - last->pool_idle_time) / (XINTFRAC*(double)delta_time_base);
+	pool_free_time_pct=pool_free_time*100/phys_cpus_pool;
+
+        /* busy CPUs in Pool = phys_cpus_pool - app */
+	pool_busy_time=(double)dlt_pool_busy_time/(XINTFRAC*(double)delta_time_base);
+	pool_busy_time_pct= pool_busy_time * 100 / phys_cpus_pool;
+
+        /* busy CPUs in managed system = Shared Pool 0 usage */
+	shcpu_busy_time=(double)dlt_shcpu_busy_time/(XINTFRAC*(double)delta_time_base);
+	shcpu_busy_time_pct=shcpu_busy_time * 100 / (double)shcpus_in_sys;
+	/* free CPUs in managed system = busy CPUs - shcpus_in_sys */
+	shcpu_free_time=shcpus_in_sys - shcpu_busy_time;
+	shcpu_free_time_pct=shcpu_free_time * 100 / (double)shcpus_in_sys;
+
+	/* maximum capacity of the pool (cap of a user defined pool) and reserved capacity,
+	 * a capped pool is full long before its physical CPUs are busy */
+	if (now->pool_max_time > last->pool_max_time) {
+	    set_metric(M_POOL_MAX_CAP, (double)(now->pool_max_time - last->pool_max_time) / (XINTFRAC*(double)delta_time_base));
+	    set_metric(M_POOL_RESERVED, (double)now->entitled_pool_capacity / 100.0);
+	    set_metric(M_POOL_CAP_USED_PCT, (double)dlt_pool_busy_time * 100 / (double)(now->pool_max_time - last->pool_max_time));
+	}
+
+	/* share of this LPAR in the pool usage and consumption above the fair share under contention,
+	 * LPARs above their fair share hit a performance cliff when their neighbours get busy */
+	if (pool_busy_time > 0)
+	    set_metric(M_POOL_SHARE_PCT, phys_proc_consumed * 100 / pool_busy_time);
+	set_metric(M_FAIR_SHARE, fair_share(now, metrics[M_POOL_MAX_CAP].available ?
+					    metrics[M_POOL_MAX_CAP].value : (double)phys_cpus_pool));
+	set_metric(M_FAIR_SHARE_EXCESS, phys_proc_consumed - metrics[M_FAIR_SHARE].value);
+    }
+}
+
+/* create the shared memory snapshot of the sampler daemon, only one daemon per LPAR
+ * seq, version, size and pid lead the snapshot in all versions, a daemon of any version is found */
+struct shm_snapshot *create_shm_snapshot(void)
+{
+	struct shm_snapshot *shm;
+	struct shmid_ds ds;
+	pid_t owner;
+	int shmid;
+
+	if ((shmid = shmget(SHM_KEY, 0, 0)) >= 0) {
+		owner = 0;
+		if (shmctl(shmid, IPC_STAT, &ds) == 0 && ds.shm_segsz >= offsetof(struct shm_snapshot, pid) + sizeof(pid_t) &&
+		    (shm = (struct shm_snapshot *)shmat(shmid, NULL, SHM_RDONLY)) != (void *)-1) {
+			owner = shm->pid;
+			shmdt((void *)shm);
+		}
+		/* EPERM: the daemon runs under another user */
+		if (owner > 0 && owner != getpid() && (kill(owner, 0) == 0 || errno == EPERM)) {
+			printf("ENT_POOLS UNKNOWN Sampler daemon already running with pid %d\n", (int)owner);
+			exit(STATE_UNKNOWN);
+		}
+		/* left over from a dead daemon, maybe with a different snapshot layout */
+		if (shmctl(shmid, IPC_STAT, &ds) == 0 && ds.shm_segsz != sizeof(struct shm_snapshot))
+			shmctl(shmid, IPC_RMID, NULL);
+	}
+	shmid = shmget(SHM_KEY, sizeof(struct shm_snapshot), IPC_CREAT | 0644);
+	if (shmid < 0 || (shm = (struct shm_snapshot *)shmat(shmid, NULL, 0)) == (void *)-1) {
+		printf("ENT_POOLS UNKNOWN Cannot create shared memory: %s\n", strerror(errno));
+		exit(STATE_UNKNOWN);
+	}
+
+	memset((void *)shm, 0, sizeof(struct shm_snapshot));
+	shm->version = SHM_VERSION;
+	shm->size = sizeof(struct shm_snapshot);
+	shm->pid = getpid();
+	shm->interval = interval;
+	return shm;
+}
+
+/* the results in a window of the snapshot, seconds first, it weights the others when windows are joined */
+struct window_field {
+	size_t offset;		/* in struct shm_window */
+	double *value;		/* result of calculate_values */
+} window_fields[] = {
+	{ offsetof(struct shm_window, seconds), &window },
+	{ offsetof(struct shm_window, phys_proc_consumed), &phys_proc_consumed },
+	{ offsetof(struct shm_window, percent_ent), &percent_ent },
+	{ offsetof(struct shm_window, vcpu_busy), &vcpu_busy },
+	{ offsetof(struct shm_window, pool_busy_time), &pool_busy_time },
+	{ offsetof(struct shm_window, pool_busy_time_pct), &pool_busy_time_pct },
+	{ offsetof(struct shm_window, pool_free_time), &pool_free_time },
+	{ offsetof(struct shm_window, pool_free_time_pct), &pool_free_time_pct },
+	{ offsetof(struct shm_window, shcpu_busy_time), &shcpu_busy_time },
+	{ offsetof(struct shm_window, shcpu_busy_time_pct), &shcpu_busy_time_pct },
+	{ offsetof(struct shm_window, shcpu_free_time), &shcpu_free_time },
+	{ offsetof(struct shm_window, shcpu_free_time_pct), &shcpu_free_time_pct },
+	{ offsetof(struct shm_window, vcsw_vol), &metrics[M_VCSW_VOL].value },
+	{ offsetof(struct shm_window, vcsw_invol), &metrics[M_VCSW_INVOL].value },
+};
+#define WINDOW_FIELDS		(sizeof(window_fields) / sizeof(window_fields[0]))
+#define window_field(w, f)	(*(double *)((char *)(w) + window_fields[f].offset))
+
+/* copy the monitoring results to a window of the snapshot */
+void save_window(struct shm_window *w)
+{
+	int f;
+
+	for (f = 0; f < WINDOW_FIELDS; f++)
+		window_field(w, f) = *window_fields[f].value;
+}
+
+/* publish the current monitoring results, readers retry while seq is odd or changed */
+void publish_shm_snapshot(struct shm_snapshot *shm, struct shm_window *windows)
+{
+	shm->seq++;
+	memory_barrier();
+
+	shm->updated = time(NULL);
+	shm->late = sampler_late;
+	shm->late_max = sampler_late_max;
+	shm->type = lpar_type;
+	shm->pool_id = pool_id;
+	shm->phys_cpus_pool = phys_cpus_pool;
+	shm->max_entitlement = max_entitlement;
+	shm->shcpus_in_sys = shcpus_in_sys;
+	shm->entitlement = entitlement;
+	memcpy(shm->windows, windows, sizeof(shm->windows));
+
+	memory_barrier();
+	shm->seq++;
+}
+
+/* take the monitoring results from the latest consistent snapshot of the sampler daemon */
+void read_shm_snapshot(void)
+{
+	struct shm_snapshot snapshot;
+	struct shm_window *w;
+	int f;
+
+	copy_shm_snapshot("ENT_POOLS", &snapshot, verbose);
+	w = &snapshot.windows[shm_window];
+	memcpy(shm_windows, snapshot.windows, sizeof(shm_windows));
+	if (verbose && shm_window) { printf("Window %s covers %.0f seconds\n", shm_window_names[shm_window], w->seconds); }
+
+	sampler_late = snapshot.late;
+	sampler_late_max = snapshot.late_max;
+	lpar_type = snapshot.type;
+	pool_id = snapshot.pool_id;
+	phys_cpus_pool = snapshot.phys_cpus_pool;
+	max_entitlement = snapshot.max_entitlement;
+	shcpus_in_sys = snapshot.shcpus_in_sys;
+	entitlement = snapshot.entitlement;
+	for (f = 0; f < WINDOW_FIELDS; f++)
+		*window_fields[f].value = window_field(w, f);
+	metrics[M_VCSW_VOL].available = metrics[M_VCSW_INVOL].available = TRUE;
+}
+
+/* results of the ring from step from to step to, the seconds marked in gap_ring are left out
+ * the results of the parts between the gaps are weighted by their length */
+void calculate_window(struct shm_window *w, long from, long to)
+{
+	struct shm_window part;
+	long start, k;
+	int f;
+
+	/* no gap inside the window: the counters at both ends are enough */
+	if (last_gap <= from) {
+		calculate_values(&window_ring[from % WINDOW_RING], &window_ring[to % WINDOW_RING]);
+		save_window(w);
+		return;
+	}
+
+	memset(w, 0, sizeof(struct shm_window));
+	for (start = from, k = from + 1; k <= to + 1; k++) {
+		if (k <= to && !gap_ring[k % WINDOW_RING])
+			continue;
+		if (k - 1 > start) {
+			calculate_values(&window_ring[start % WINDOW_RING], &window_ring[(k - 1) % WINDOW_RING]);
+			save_window(&part);
+			w->seconds += part.seconds;
+			for (f = 1; f < WINDOW_FIELDS; f++)
+				window_field(w, f) += window_field(&part, f) * part.seconds;
+		}
+		start = k;
+	}
+	if (w->seconds == 0)
+		return;
+	for (f = 1; f < WINDOW_FIELDS; f++)
+		window_field(w, f) /= w->seconds;
+}
+
+/* sampler daemon: one perfstat call per second, the results of the last interval and over 1, 5 and 15 minutes
+ * go to shared memory every second, never returns */
+void run_sampler(void)
+{
+	struct shm_window windows[SHM_WINDOWS];
+	struct shm_snapshot *shm;
+	long n, steps, ring_start = 0;
+	struct sample_clock last_clock, clock;
+	int i;
+	char *reason;
+	int w;
+
+	shm = create_shm_snapshot();
+
+	if (align)
+		wait_for_boundary();
+	else
+		align_start = wallclock();
+	if (!sample_partition(&window_ring[0], &last_clock)) {
+		printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+		exit(STATE_UNKNOWN);
+	}
+	for (n = 1; ; n++) {
+		/* sample ends are absolute, the results do not drift */
+		sleep_until(align_start + (double)n);
+		late_ring[n % WINDOW_RING] = wakeup_late;
+		gap_ring[n % WINDOW_RING] = FALSE;
+		if (!sample_partition(&window_ring[n % WINDOW_RING], &clock)) {
+			/* clients notice the outdated snapshot, the windows leave this second out */
+			if (verbose) { printf("Error getting perfstat data from perfstat_partition_total\n"); }
+			window_ring[n % WINDOW_RING] = window_ring[(n - 1) % WINDOW_RING];
+			gap_ring[n % WINDOW_RING] = TRUE;
+			last_gap = n;
+			continue;
+		}
+
+		if ((reason = sample_discontinuity(&window_ring[(n - 1) % WINDOW_RING], &last_clock,
+						&window_ring[n % WINDOW_RING], &clock))) {
+			if (reason == timebase_jump) {
+				/* timebase jump (partition mobility): only this second is wrong */
+				if (verbose) { printf("%s, leaving this second out of the windows\n", reason); }
+				gap_ring[n % WINDOW_RING] = TRUE;
+				last_gap = n;
+			} else {
+				/* DLPAR or counter reset: the deltas would mix two configurations */
+				if (verbose) { printf("%s, restarting all windows\n", reason); }
+				ring_start = n;
+			}
+		}
+		last_clock = clock;
+		if (ring_start == n)
+			continue;
+
+		/* the ring advances every second, the windows are exact for any interval */
+		for (w = SHM_WINDOWS - 1; w >= 0; w--) {
+			steps = w ? shm_window_length[w] : interval;
+			if (steps > n - ring_start)
+				steps = n - ring_start;
+			calculate_window(&windows[w], n - steps, n);
+		}
+		if (windows[0].seconds == 0)
+			continue;	/* the whole interval is left out, clients keep the last results */
+
+		/* wake-up lateness of this sample and its maximum over the last minute */
+		sampler_late = sampler_late_max = wakeup_late;
+		for (i = 1; i < 60 && i <= n; i++)
+			if (late_ring[(n - i) % WINDOW_RING] > sampler_late_max)
+				sampler_late_max = late_ring[(n - i) % WINDOW_RING];
+		publish_shm_snapshot(shm, windows);
+
+		if (verbose) { printf("ent_used=%.2f vcpu_busy=%.2f pool_used=%.2f pool_free=%.2f syspool_used=%.2f syspool_free=%.2f late=%.2fms\n",
+					windows[0].phys_proc_consumed, windows[0].vcpu_busy, windows[0].pool_busy_time,
+					windows[0].pool_free_time, windows[0].shcpu_busy_time, windows[0].shcpu_free_time,
+					sampler_late * 1000);
+				fflush(stdout); }
+	}
+}
+
+/* add the values of the current slice to the running sums and check if all results are settled */
+int adaptive_settled(int n)
+{
+	struct adaptive_metric *m;
+	double mean, half;
+	int settled = TRUE;
+
+	for (m = adaptive_metrics; m < adaptive_metrics + ADAPTIVE_METRICS; m++) {
+		if (n == 1)
+			m->sum = m->sumsq = 0;
+		m->sum += *m->value;
+		m->sumsq += *m->value * *m->value;
+
+		if (n < ADAPTIVE_MIN_SLICES || (!m->warning->set && !m->critical->set))
+			continue;
+		mean = m->sum / n;
+		/* standard error of the mean of n slices */
+		half = (m->sumsq - m->sum * mean) / (n - 1);
+		half = ADAPTIVE_Z * sqrt(half > 0 ? half / n : 0);
+		if (range_near(m->warning, mean, half) || range_near(m->critical, mean, half))
+			settled = FALSE;
+	}
+	return n >= ADAPTIVE_MIN_SLICES && settled;
+}
+
+/* allocate the buffers of the logical CPU scan, before the measurement starts */
+void init_cpu_scan(void)
+{
+	perfstat_cpu_total_t cpu_total;
+
+	if ((cpu_buffer_size = perfstat_cpu(NULL, NULL, sizeof(perfstat_cpu_t), 0)) <= 0) {
+		printf("ENT_POOLS UNKNOWN Error getting number of logical CPUs from perfstat_cpu\n");
+		exit(STATE_UNKNOWN);
+	}
+	if (perfstat_cpu_total(NULL, &cpu_total, sizeof(perfstat_cpu_total_t), 1) != 1) {
+		printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_cpu_total\n");
+		exit(STATE_UNKNOWN);
+	}
+	lcpus_online = cpu_total.ncpus;
+	cpu_buffer = malloc(cpu_buffer_size * sizeof(perfstat_cpu_t));
+	cpu_busy = malloc(cpu_buffer_size * sizeof(double));
+	cpu_start.id = malloc(cpu_buffer_size * sizeof(int));
+	cpu_start.busy = malloc(cpu_buffer_size * sizeof(u_longlong_t));
+	cpu_start.total = malloc(cpu_buffer_size * sizeof(u_longlong_t));
+	cpu_end.id = malloc(cpu_buffer_size * sizeof(int));
+	cpu_end.busy = malloc(cpu_buffer_size * sizeof(u_longlong_t));
+	cpu_end.total = malloc(cpu_buffer_size * sizeof(u_longlong_t));
+	if (!cpu_buffer || !cpu_busy || !cpu_start.id || !cpu_start.busy || !cpu_start.total ||
+	    !cpu_end.id || !cpu_end.busy || !cpu_end.total) {
+		printf("ENT_POOLS UNKNOWN Out of memory for %d logical CPUs\n", cpu_buffer_size);
+		exit(STATE_UNKNOWN);
+	}
+}
+
+/* PURR counters of all logical CPUs, taken right after the partition counters */
+void sample_cpus(struct cpu_counters *c)
+{
+	perfstat_id_t first;
+	int i;
+
+	strcpy(first.name, FIRST_CPU);
+	if ((c->count = perfstat_cpu(&first, cpu_buffer, sizeof(perfstat_cpu_t), cpu_buffer_size)) <= 0) {
+		printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_cpu\n");
+		exit(STATE_UNKNOWN);
+	}
+	for (i = 0; i < c->count; i++) {
+		c->id[i] = atoi(cpu_buffer[i].name + strcspn(cpu_buffer[i].name, "0123456789"));
+		c->busy[i] = cpu_buffer[i].puser + cpu_buffer[i].psys;
+		c->total[i] = c->busy[i] + cpu_buffer[i].pidle + cpu_buffer[i].pwait;
+	}
+}
+
+/* busy PURR ticks of every logical CPU in percent of the timebase ticks of the measurement period, reduced
+ * to max, min, standard deviation and the number of saturated logical CPUs. A single threaded job saturates
+ * one logical CPU while vcpu_busy is low. Logical CPUs without PURR ticks (ceded or folded) count as idle,
+ * a logical CPU dispatched only briefly counts with its short busy time, not with its busy share. */
+#define SATURATED_PCT	95.0
+
+/* a vCPU is unfolded when its SMT threads were dispatched for at least 1% of the measurement period */
+#define UNFOLDED_PCT	1.0
+
+void calculate_cpu_scan(void)
+{
+	double busy, max = 0, min = 100, sum = 0, sum2 = 0;
+	double ticks, spread = 0, thread_max, thread_min;
+	u_longlong_t dispatched;
+	int i, n, saturated = 0;
+	int v, threads, unfolded = 0;
+
+	/* the counters of a logical CPU are only compared with the counters of the same logical CPU, after a
+	 * DLPAR or SMT change the logical CPU metrics are not available for this measurement */
+	if (cpu_start.count != cpu_end.count) {
+		if (verbose) { printf("Logical CPUs changed from %d to %d, no logical CPU metrics\n", cpu_start.count, cpu_end.count); }
+		return;
+	}
+	n = cpu_end.count;
+	for (i = 0; i < n; i++)
+		if (cpu_start.id[i] != cpu_end.id[i]) {
+			if (verbose) { printf("Logical CPU cpu%d changed to cpu%d, no logical CPU metrics\n", cpu_start.id[i], cpu_end.id[i]); }
+			return;
+		}
+	ticks = window * 1000000000.0 / XINTFRAC;
+	for (i = 0; i < n; i++) {
+		busy = ticks > 0 ? (double)(cpu_end.busy[i] - cpu_start.busy[i]) * 100 / ticks : 0;
+		cpu_busy[i] = busy;
+		max = busy > max ? busy : max;
+		min = busy < min ? busy : min;
+		sum += busy;
+		sum2 += busy * busy;
+		saturated += busy >= SATURATED_PCT;
+	}
+	if (n == 0)
+		return;
+
+	set_metric(M_LCPU_BUSY_MAX, max);
+	set_metric(M_LCPU_BUSY_MIN, min);
+	set_metric(M_LCPU_BUSY_STDDEV, sqrt(fmax(sum2 / n - (sum / n) * (sum / n), 0)));
+	set_metric(M_LCPU_SATURATED, saturated);
+	if (verbose) { printf("Logical CPU scan over %d CPUs\n", n); }
+
+	/* folding and SMT: the SMT threads of a vCPU are consecutive logical CPUs, a folded vCPU gets no
+	 * PURR ticks at all, the busy spread between the threads of an unfolded vCPU shows how SMT is used */
+	threads = max_entitlement ? lcpus_online / max_entitlement : 0;
+	if (threads < 1 || n != lcpus_online || n != threads * max_entitlement) {
+		if (verbose) { printf("%d logical CPUs don't match %d vCPUs, no folding metrics\n", n, max_entitlement); }
+		return;
+	}
+	for (v = 0; v < n / threads; v++) {
+		dispatched = 0;
+		thread_max = 0;
+		thread_min = 100;
+		for (i = v * threads; i < (v + 1) * threads; i++) {
+			dispatched += cpu_end.total[i] - cpu_start.total[i];
+			thread_max = cpu_busy[i] > thread_max ? cpu_busy[i] : thread_max;
+			thread_min = cpu_busy[i] < thread_min ? cpu_busy[i] : thread_min;
+		}
+		if ((double)dispatched * 100 < ticks * UNFOLDED_PCT)
+			continue;
+		unfolded++;
+		spread += thread_max - thread_min;
+	}
+	set_metric(M_VCPU_UNFOLDED, unfolded);
+	set_metric(M_VCPU_FOLDED, n / threads - unfolded);
+	set_metric(M_SMT_SPREAD, unfolded ? spread / unfolded : 0);
+	if (verbose) { printf("SMT%d, %d of %d vCPUs unfolded\n", threads, unfolded, n / threads); }
+}
+
+/* CPU time counters of all processes, the buffer grows with the number of processes */
+void sample_processes(struct proc_snapshot *p)
+{
+	perfstat_id_t first;
+	int n;
+
+	if ((n = perfstat_process(NULL, NULL, sizeof(perfstat_process_t), 0)) < 0) {
+		printf("ENT_POOLS UNKNOWN Error getting number of processes from perfstat_process\n");
+		exit(STATE_UNKNOWN);
+	}
+	if (n > p->size) {
+		p->size = n + n / 8 + 64;	/* room for processes started until the next call */
+		if (!(p->procs = realloc(p->procs, p->size * sizeof(perfstat_process_t)))) {
+			printf("ENT_POOLS UNKNOWN Out of memory for %d processes\n", p->size);
+			exit(STATE_UNKNOWN);
+		}
+	}
+	strcpy(first.name, "");
+	if ((p->count = perfstat_process(&first, p->procs, sizeof(perfstat_process_t), p->size)) < 0) {
+		printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_process\n");
+		exit(STATE_UNKNOWN);
+	}
+}
+
+/* busy PURR counters of all WPARs, one perfstat_cpu_total_wpar call per WPAR */
+void sample_wpars(struct wpar_snapshot *w)
+{
+	perfstat_id_wpar_t id;
+	perfstat_cpu_total_t cpu;
+	int i, n;
+
+	if ((n = perfstat_wpar_total(NULL, NULL, sizeof(perfstat_wpar_total_t), 0)) < 0) {
+		printf("ENT_POOLS UNKNOWN Error getting number of WPARs from perfstat_wpar_total\n");
+		exit(STATE_UNKNOWN);
+	}
+	if (n > w->size) {
+		w->size = n + 8;	/* room for WPARs started until the next call */
+		w->wpars = realloc(w->wpars, w->size * sizeof(perfstat_wpar_total_t));
+		w->busy = realloc(w->busy, w->size * sizeof(u_longlong_t));
+		if (!w->wpars || !w->busy) {
+			printf("ENT_POOLS UNKNOWN Out of memory for %d WPARs\n", w->size);
+			exit(STATE_UNKNOWN);
+		}
+	}
+	memset(&id, 0, sizeof(id));
+	id.spec = WPARNAME;
+	if ((w->count = perfstat_wpar_total(&id, w->wpars, sizeof(perfstat_wpar_total_t), w->size)) < 0) {
+		printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_wpar_total\n");
+		exit(STATE_UNKNOWN);
+	}
+	for (i = 0; i < w->count; i++) {
+		memset(&id, 0, sizeof(id));
+		id.spec = WPARID;
+		id.u.wpar_id = w->wpars[i].wpar_id;
+		if (perfstat_cpu_total_wpar(&id, &cpu, sizeof(perfstat_cpu_total_t), 1) != 1) {
+			printf("ENT_POOLS UNKNOWN Error getting perfstat data of WPAR %s from perfstat_cpu_total_wpar\n", w->wpars[i].name);
+			exit(STATE_UNKNOWN);
+		}
+		w->busy[i] = cpu.puser + cpu.psys;
+	}
+}
+
+/* run queue and swap queue counters */
+void sample_runq(struct runq_counters *r)
+{
+	perfstat_cpu_total_t cpu_total;
+
+	if (perfstat_cpu_total(NULL, &cpu_total, sizeof(perfstat_cpu_total_t), 1) != 1) {
+		printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_cpu_total\n");
+		exit(STATE_UNKNOWN);
+	}
+	r->runque = cpu_total.runque;
+	r->swpque = cpu_total.swpque;
+	r->ncpus = cpu_total.ncpus;
+}
+
+/* runnable threads over the measurement period, in total, per vCPU and per logical CPU, and threads
+ * waiting for memory. Queueing at a low vcpu_busy needs more vCPUs, at 100% more entitlement or pool capacity */
+void calculate_runq(void)
+{
+	double runq = (double)(runq_end.runque - runq_start.runque) / window;
+
+	set_metric(M_RUNQ, runq);
+	if (max_entitlement)
+		set_metric(M_RUNQ_VCPU, runq / (double)max_entitlement);
+	if (runq_end.ncpus)
+		set_metric(M_RUNQ_LCPU, runq / (double)runq_end.ncpus);
+	set_metric(M_SWPQ, (double)(runq_end.swpque - runq_start.swpque) / window);
+}
+
+/* per logical CPU, per process and per WPAR counters, taken right after the partition counters
+ * at the start (end FALSE) or the end (end TRUE) of the measurement period */
+void sample_scans(int end)
+{
+	if (cpu_scan)
+		sample_cpus(end ? &cpu_end : &cpu_start);
+	if (runq_scan)
+		sample_runq(end ? &runq_end : &runq_start);
+	if (top_count)
+		sample_processes(end ? &proc_end : &proc_start);
+	if (wpar_mode)
+		sample_wpars(end ? &wpar_end : &wpar_start);
+}
+
+/* the end of the measurement period is the start of a new one */
+void restart_scans(void)
+{
+	struct cpu_counters cpus = cpu_start;
+	struct proc_snapshot procs = proc_start;
+	struct wpar_snapshot wpars = wpar_start;
+	struct runq_counters runq = runq_start;
+
+	cpu_start = cpu_end;
+	cpu_end = cpus;
+	proc_start = proc_end;
+	proc_end = procs;
+	wpar_start = wpar_end;
+	wpar_end = wpars;
+	runq_start = runq_end;
+	runq_end = runq;
+}
+
+/* consumption of every WPAR over the measurement period, WPARs are matched by id */
+void calculate_wpars(void)
+{
+	double ticks = window * 1000000000.0 / XINTFRAC;
+	int i, k;
+
+	if (!(wpar_results = realloc(wpar_results, (wpar_end.count + 1) * sizeof(struct wpar_result)))) {
+		printf("ENT_POOLS UNKNOWN Out of memory for %d WPARs\n", wpar_end.count);
+		exit(STATE_UNKNOWN);
+	}
+	for (i = 0; i < wpar_end.count; i++) {
+		wpar_results[i].valid = FALSE;
+		for (k = 0; k < wpar_start.count; k++)
+			if (wpar_start.wpars[k].wpar_id == wpar_end.wpars[i].wpar_id)
+				break;
+		if (k == wpar_start.count || wpar_end.busy[i] < wpar_start.busy[k])
+			continue;	/* started or restarted during the measurement */
+		wpar_results[i].valid = TRUE;
+		wpar_results[i].used = (double)(wpar_end.busy[i] - wpar_start.busy[k]) / ticks;
+		wpar_results[i].ent_share = wpar_results[i].used * 100 / entitlement;
+	}
+}
+
+/* thresholds of a WPAR, NULL when there are none */
+struct wpar_threshold *find_wpar_threshold(char *name)
+{
+	struct wpar_threshold *all = NULL;
+	int i;
+
+	for (i = 0; i < wpar_threshold_count; i++) {
+		if (strcmp(wpar_thresholds[i].name, name) == 0)
+			return &wpar_thresholds[i];
+		if (strcmp(wpar_thresholds[i].name, "*") == 0)
+			all = &wpar_thresholds[i];
+	}
+	return all;
+}
+
+int compare_pid(const void *a, const void *b)
+{
+	const perfstat_process_t *x = a, *y = b;
+
+	return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+/* add a process to the heap of the top consumers, O(log top_count) */
+void top_push(double cpu, perfstat_process_t *proc)
+{
+	struct consumer c = { cpu, proc };
+	int i, child;
+
+	if (top_used < top_count) {
+		/* sift up */
+		for (i = top_used++; i > 0 && top[(i - 1) / 2].cpu > cpu; i = (i - 1) / 2)
+			top[i] = top[(i - 1) / 2];
+		top[i] = c;
+		return;
+	}
+	if (cpu <= top[0].cpu)
+		return;
+	/* replace the smallest and sift down */
+	for (i = 0; (child = 2 * i + 1) < top_used; i = child) {
+		if (child + 1 < top_used && top[child + 1].cpu < top[child].cpu)
+			child++;
+		if (top[child].cpu >= cpu)
+			break;
+		top[i] = top[child];
+	}
+	top[i] = c;
+}
+
+int compare_consumer(const void *a, const void *b)
+{
+	const struct consumer *x = a, *y = b;
+
+	return (x->cpu < y->cpu) - (x->cpu > y->cpu);
+}
+
+/* top consumers of the measurement period: processes of the end snapshot are matched by pid
+ * with the sorted start snapshot, processes started in between count with all their CPU time */
+void select_top_consumers(void)
+{
+	perfstat_process_t *start;
+	double cpu;
+	int i;
+
+	qsort(proc_start.procs, proc_start.count, sizeof(perfstat_process_t), compare_pid);
+	for (i = 0; i < proc_end.count; i++) {
+		cpu = proc_end.procs[i].ucpu_time + proc_end.procs[i].scpu_time;
+		if ((start = bsearch(&proc_end.procs[i], proc_start.procs, proc_start.count,
+				     sizeof(perfstat_process_t), compare_pid)))
+			cpu -= start->ucpu_time + start->scpu_time;
+		/* milliseconds of CPU time to CPUs, less than shown in the output doesn't count */
+		cpu /= window * 1000.0;
+		if (cpu >= 0.01)
+			top_push(cpu, &proc_end.procs[i]);
+	}
+	qsort(top, top_used, sizeof(struct consumer), compare_consumer);
+}
+
+/* who is burning it: top consumers in the output, only when the check is not OK */
+void print_top_consumers(int state)
+{
+	int i;
+
+	if (!top_count || state == STATE_OK)
+		return;
+	select_top_consumers();
+	printf(" top:");
+	for (i = 0; i < top_used; i++)
+		printf(" %s[%llu]=%.2f", top[i].proc->proc_name, (unsigned long long)top[i].proc->pid, top[i].cpu);
+}
+
+/* sample every sample_ms milliseconds during the interval, the values of each slice go into the ring buffer
+ * first are the counters at the start (wall clock time start), now the counters at the end of the interval,
+ * first_clock and now_clock the clock readings around their perfstat calls
+ * adaptive sampling ends the interval early when the results are settled
+ * returns the number of slices since the last configuration change, 0 when there is no usable slice */
+int sample_slices(perfstat_partition_total_t *first, struct sample_clock *first_clock,
+		  perfstat_partition_total_t *now, struct sample_clock *now_clock, double start)
+{
+	perfstat_partition_total_t prev;
+	struct sample_clock prev_clock;
+	char *reason;
+	int i, k, n;
+
+	n = interval * 1000 / sample_ms;
+	prev = *first;
+	prev_clock = *first_clock;
+
+	for (i = 1, k = 0; i <= n; i++) {
+		/* slice ends are absolute, a late slice does not delay the following ones */
+		sleep_until(period_end(start + (double)i * sample_ms / 1000.0));
+
+		if (!sample_partition(now, now_clock)) {
+			printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+			exit(STATE_UNKNOWN);
+		}
+
+		/* partition mobility or DLPAR: only the slices after the change count */
+		reason = sample_discontinuity(&prev, &prev_clock, now, now_clock);
+		prev_clock = *now_clock;
+		if (reason) {
+			if (verbose) { printf("%s in slice %d, measuring from there\n", reason, i); }
+			*first = prev = *now;
+			*first_clock = *now_clock;
+			slices.count = slices.next = k = 0;
+			sample_scans(FALSE);
+			if (shortened)
+				break;
+			/* at least one slice after the change */
+			if (i == n)
+				n++;
+			continue;
+		}
+		calculate_values(&prev, now);
+		prev = *now;
+		k++;
+
+		slices.phys_proc_consumed[slices.next] = phys_proc_consumed;
+		slices.pool_busy_time[slices.next] = pool_busy_time;
+		slices.pool_free_time[slices.next] = pool_free_time;
+		slices.next = (slices.next + 1) % MAX_SLICES;
+		if (slices.count < MAX_SLICES)
+			slices.count++;
+
+		if (shortened)
+			break;
+		if (adaptive && i < n && adaptive_settled(k)) {
+			if (verbose) { printf("Results settled after %d of %d slices\n", i, n); }
+			break;
+		}
+	}
+	return k;
+}
+
+int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* percentile p (0..100) of the slice values, nearest rank method */
+double slice_percentile(double *values, double p)
+{
+	static double sorted[MAX_SLICES];
+	int rank;
+
+	memcpy(sorted, values, slices.count * sizeof(double));
+	qsort(sorted, slices.count, sizeof(double), compare_double);
+
+	rank = (int)ceil(p / 100.0 * slices.count);
+	if (rank < 1)
+		rank = 1;
+	return sorted[rank - 1];
+}
+
+/* replace the means of the interval by the selected statistic of the slices
+ * free capacity uses the mirrored percentile, e.g. p95 of pool usage goes with p5 of free pool capacity */
+void apply_statistic(void)
+{
+	if (statistic == 0 || slices.count == 0)
+		return;
+
+	phys_proc_consumed = slice_percentile(slices.phys_proc_consumed, statistic);
+	percent_ent = (phys_proc_consumed / entitlement) * 100;
+	vcpu_busy = (phys_proc_consumed / (double)max_entitlement) * 100;
+
+	if (lpar_type.b.shared_enabled && lpar_type.b.pool_util_authority) {
+		pool_busy_time = slice_percentile(slices.pool_busy_time, statistic);
+		pool_busy_time_pct = pool_busy_time * 100 / phys_cpus_pool;
+		pool_free_time = slice_percentile(slices.pool_free_time, 100 - statistic);
+		pool_free_time_pct = pool_free_time * 100 / phys_cpus_pool;
+	}
+}
+
+/* consumption at the cap within the accuracy of the PURR counters */
+#define THROTTLE_LIMIT	0.98
+
+/* capped shared LPAR: percentage of the measurement period spent at the entitlement cap, i.e. throttled
+ * counted over the slices of the high-frequency sampling, without slices the period is one slice */
+void calculate_throttled(void)
+{
+	int i, n = 0;
+
+	if (!lpar_type.b.shared_enabled || !lpar_type.b.capped)
+		return;
+	if (slices.count == 0) {
+		set_metric(M_THROTTLED_PCT, phys_proc_consumed >= entitlement * THROTTLE_LIMIT ? 100.0 : 0.0);
+		return;
+	}
+	for (i = 0; i < slices.count; i++)
+		if (slices.phys_proc_consumed[i] >= entitlement * THROTTLE_LIMIT)
+			n++;
+	set_metric(M_THROTTLED_PCT, n * 100.0 / slices.count);
+}
+
+/* min, max and percentiles of one slice metric as perfdata */
+void print_slice_perfdata(const char *label, double *values)
+{
+	printf(" %s_min=%.2f %s_p50=%.2f %s_p95=%.2f %s_p99=%.2f %s_max=%.2f",
+			label, slice_percentile(values, 0),
+			label, slice_percentile(values, 50),
+			label, slice_percentile(values, 95),
+			label, slice_percentile(values, 99),
+			label, slice_percentile(values, 100)
+			);
+}
+
+/* compare the monitoring results with the thresholds and set the monitor states */
+void check_thresholds(void)
+{
+	int m;
+
+	ent_pool_state = ent_state = vcpu_busy_state = STATE_OK;
+	pool_state = pool_free_state = STATE_OK;
+	syspool_state = syspool_free_state = STATE_OK;
+
+	/* Compare critical and warning values */
+	
+	/* Entitlement checks */
+	/* maximum percentage is 2000% only on LPARs with minimum entitlement of 0.05 per virtual processor
+	 * effective maximum percentage decreases when entitlement is increased, this is currently not checked for sanity
+	 * the effective maximum percentage is 100% with dedicated donating, but you can still enter 2000% on the command-line */
+	temp_state=get_range_status("Entitlement percentage check", percent_ent, &entitlement_warning_pct, &entitlement_critical_pct);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	ent_state = max_state(ent_state, temp_state);			/* entitlement monitor state */
+
+	temp_state=get_range_status("Entitlement check", phys_proc_consumed, &entitlement_warning, &entitlement_critical);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	ent_state = max_state(ent_state, temp_state);			/* entitlement monitor state */
+	
+	/* vCPU busy checks */
+	temp_state=get_range_status("vCPU busy percentage check", vcpu_busy, &vcpu_busy_warning_pct, &vcpu_busy_critical_pct);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	vcpu_busy_state = max_state(ent_state,temp_state);		/* vcpu busy monitor state */
+
+	/* Pool usage, all pool values and thresholds are 0 in dedicated donating mode */
+	temp_state=get_range_status("Pool usage percentage check", pool_busy_time_pct, &pool_warning_pct, &pool_critical_pct);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	pool_state = max_state(pool_state, temp_state);			/* pool monitor state */
+
+	temp_state=get_range_status("Pool usage check", pool_busy_time, &pool_warning, &pool_critical);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	pool_state = max_state(pool_state, temp_state);			/* pool monitor state */
+	
+	/* Pool free */
+	temp_state=get_range_status("Pool free percentage check", pool_free_time_pct, &pool_free_warning_pct, &pool_free_critical_pct);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	pool_free_state = max_state(pool_free_state, temp_state);	/* pool free monitor state */
+
+	temp_state=get_range_status("Pool free check", pool_free_time, &pool_free_warning, &pool_free_critical);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	pool_free_state = max_state(pool_free_state, temp_state);	/* pool free monitor state */
+
+	/* System pool usage */
+	temp_state=get_range_status("System pool usage percentage check", shcpu_busy_time_pct, &system_warning_pct, &system_critical_pct);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	syspool_state = max_state(syspool_state, temp_state);		/* system pool state */
+
+	temp_state=get_range_status("System pool usage check", shcpu_busy_time, &system_warning, &system_critical);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	syspool_state = max_state(syspool_state, temp_state);		/* system pool state */
+
+	/* System pool free */
+	temp_state=get_range_status("System pool free percentage check", shcpu_free_time_pct, &system_free_warning_pct, &system_free_critical_pct);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	syspool_free_state = max_state(syspool_free_state, temp_state);	/* system pool free state */
+
+	temp_state=get_range_status("System pool free check", shcpu_free_time, &system_free_warning, &system_free_critical);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	syspool_free_state = max_state(syspool_free_state, temp_state);	/* system pool free state */
+
+	/* additional metrics */
+	for (m = 0; m < METRICS; m++) {
+		metrics[m].state = STATE_OK;
+		if (!metrics[m].available)
+			continue;
+		metrics[m].state = get_range_status(metrics[m].name, metrics[m].value, &metrics[m].warning, &metrics[m].critical);
+		ent_pool_state = max_state(ent_pool_state, metrics[m].state);	/* globale monitor state */
+	}
+
+	/* workload partitions */
+	for (m = 0; wpar_mode && m < wpar_end.count; m++) {
+		struct wpar_threshold *t = find_wpar_threshold(wpar_end.wpars[m].name);
+
+		wpar_results[m].state = STATE_OK;
+		if (!wpar_results[m].valid || !t)
+			continue;
+		temp_state=get_range_status("WPAR check", wpar_results[m].used, &t->warning, &t->critical);
+		wpar_results[m].state = max_state(temp_state,
+				get_range_status("WPAR entitlement percentage check", wpar_results[m].ent_share, &t->warning_pct, &t->critical_pct));
+		ent_pool_state = max_state(ent_pool_state, wpar_results[m].state);	/* globale monitor state */
+	}
+
+	/* when strict checking enabled, do sanity checks too */
+	if (strict) {
+		if ( phys_proc_consumed == 0 ||
+		     entitlement == 0 ||
+		     (lpar_type.b.shared_enabled && (
+		     phys_cpus_pool == 0 ||
+		     pool_busy_time == 0 ||
+		     shcpus_in_sys == 0 ||
+		     shcpu_busy_time == 0 ||
+		     phys_cpus_pool > shcpus_in_sys))
+		     /* more sanity checks to think about:
+		      * phys_proc_consumed > max_entitlement
+		      * pool_busy_time > phys_cpus_pool
+		      * shcpu_busy_time > shcpus_in_sys */
+		     ) {
+			if (verbose) { printf("Insane performance values detected\n" ); }
+			ent_pool_state=STATE_CRITICAL;
+		}
+
+	}
+}
+
+/* additional metrics with thresholds in the monitor output */
+void print_metric_status(void)
+{
+	int m;
+
+	for (m = 0; m < METRICS; m++)
+		if (metrics[m].available && (metrics[m].warning.set || metrics[m].critical.set))
+			printf(" %s=%.2f(%s)", metrics[m].name, metrics[m].value, states[metrics[m].state]);
+}
+
+/* one line per WPAR after the first line of the output */
+void print_wpars(void)
+{
+	int i;
+
+	for (i = 0; wpar_mode && i < wpar_end.count; i++) {
+		if (!wpar_results[i].valid)
+			printf("WPAR %s started during the measurement\n", wpar_end.wpars[i].name);
+		else if (find_wpar_threshold(wpar_end.wpars[i].name))
+			printf("WPAR %s used=%.2f(%s) ent_share=%.2f%%\n", wpar_end.wpars[i].name,
+					wpar_results[i].used, states[wpar_results[i].state], wpar_results[i].ent_share);
+		else
+			printf("WPAR %s used=%.2f ent_share=%.2f%%\n", wpar_end.wpars[i].name,
+					wpar_results[i].used, wpar_results[i].ent_share);
+	}
+}
+
+/* performance data of the monitoring results */
+void print_perfdata(void)
+{
+	int m, w;
+
+	if (lpar_type.b.shared_enabled) {
+		printf("ent_used=%.2f ent=%.2f ent_max=%d vcpu_busy=%.2f pool_id=%d pool_size=%d pool_used=%.2f pool_free=%.2f syspool_size=%llu syspool_used=%.2f syspool_free=%.2f",
+				phys_proc_consumed,
+				entitlement,
+				max_entitlement,
+				vcpu_busy,
+				pool_id,
+				phys_cpus_pool,
+				pool_busy_time,
+				pool_free_time,
+				shcpus_in_sys,
+				shcpu_busy_time,
+				shcpu_free_time
+				);
+	} else {
+		printf("ent_used=%.2f ent=%.2f ent_max=%d vcpu_busy=%.2f",
+				phys_proc_consumed,
+				entitlement,
+				max_entitlement,
+				vcpu_busy
+				);
+	}
+	for (m = 0; m < METRICS; m++)
+		if (metrics[m].available)
+			printf(" %s=%.2f", metrics[m].name, metrics[m].value);
+	if (adaptive || align || shm_window || timeout)
+		printf(" window=%.3fs", window);
+	if (timeout)
+		printf(" shortened=%d", shortened);
+	/* load average style results of the sampler daemon */
+	if (shm_client) {
+		printf(" sampler_late=%.2fms sampler_late_max=%.2fms", sampler_late * 1000, sampler_late_max * 1000);
+		for (w = 1; w < SHM_WINDOWS; w++) {
+			printf(" ent_used_%s=%.2f", shm_window_names[w], shm_windows[w].phys_proc_consumed);
+			if (lpar_type.b.shared_enabled)
+				printf(" pool_used_%s=%.2f syspool_used_%s=%.2f",
+						shm_window_names[w], shm_windows[w].pool_busy_time,
+						shm_window_names[w], shm_windows[w].shcpu_busy_time);
+		}
+	}
+	for (m = 0; wpar_mode && m < wpar_end.count; m++)
+		if (wpar_results[m].valid)
+			printf(" wpar_%s_used=%.2f wpar_%s_ent_share=%.2f",
+					wpar_end.wpars[m].name, wpar_results[m].used,
+					wpar_end.wpars[m].name, wpar_results[m].ent_share);
+	if (slices.count) {
+		print_slice_perfdata("ent_used", slices.phys_proc_consumed);
+		if (lpar_type.b.shared_enabled) {
+			print_slice_perfdata("pool_used", slices.pool_busy_time);
+			print_slice_perfdata("pool_free", slices.pool_free_time);
+		}
+	}
+}
+
+/* streaming: one line per interval until stream_count lines are printed, never returns
+ * the counters at the end of one interval are the start of the next one, one perfstat call per interval */
+void run_stream(perfstat_partition_total_t *last, struct sample_clock *last_clock)
+{
+	perfstat_partition_total_t lparstats;
+	struct sample_clock clock;
+	struct timeval tv;
+	char *reason;
+	long n;
+
+	for (n = 1; stream_count == 0 || n <= stream_count; n++) {
+		wakeup_late_max = 0;
+		if (sample_ms) {
+			/* percentiles of this interval only */
+			slices.count = slices.next = 0;
+			if (!sample_slices(last, last_clock, &lparstats, &clock, align_start + (double)(n - 1) * interval)) {
+				*last = lparstats;
+				*last_clock = clock;
+				continue;
+			}
+		} else {
+			/* interval ends are absolute, the output does not drift */
+			sleep_until(align_start + (double)n * interval);
+
+			if (!sample_partition(&lparstats, &clock)) {
+				printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+				exit(STATE_UNKNOWN);
+			}
+
+			/* partition mobility or DLPAR: no line for this interval */
+			if ((reason = sample_discontinuity(last, last_clock, &lparstats, &clock))) {
+				if (verbose) { printf("%s, interval skipped\n", reason); }
+				*last = lparstats;
+				*last_clock = clock;
+				continue;
+			}
+		}
+
+		calculate_values(last, &lparstats);
+		calculate_throttled();
+		if (sample_ms)
+			apply_statistic();
+		*last = lparstats;
+		*last_clock = clock;
+
+		check_thresholds();
+		gettimeofday(&tv, NULL);
+		printf("%ld %s ", (long)tv.tv_sec, states[ent_pool_state]);
+		print_perfdata();
+		printf(" late=%.2fms\n", wakeup_late_max * 1000);
+		fflush(stdout);
+	}
+	exit(STATE_OK);
+}
+
 void print_version(const char *progname,const char *version)
 {
 	printf("%s v%s\n",progname,version);
@@ -251,7 +2069,17 @@ void print_usage (void)
 	printf ("%s\n", _("Usage:"));
  	printf (" %s [ -ec=limit ] [ -ew=limit ] [ -vbw=limit ] [ -vbc=limit ] [ -pw=limit ]\n", progname);
  	printf ("     [ -pc=limit ] [ -pfw=limit ] [ -pfc=limit ] [ -sw=limit ] [ -sc=limit ]\n");
- 	printf ("     [ -sfw=limit ] [ -sfc=limit ] [ -strict ] [ -i=interval ] [ -h ] [ -v ] [ -V ]\n\n");
+ 	printf ("     [ -sfw=limit ] [ -sfc=limit ] [ -strict ] [ -i=interval ]\n");
+ 	printf ("     [ --METRIC-warning=limit ] [ --METRIC-critical=limit ]\n");
+ 	printf ("     [ --state-file=file ] [ --state-max-age=seconds ]\n");
+ 	printf ("     [ --shm ] [ --window=1m|5m|15m ]\n");
+ 	printf ("     [ --sample-ms=milliseconds ] [ --statistic=mean|p50|p95|p99|max ] [ --adaptive ]\n");
+ 	printf ("     [ --align ] [ --timeout=seconds ] [ --cpu-scan ] [ --scaled ]\n");
+ 	printf ("     [ --top=count ] [ --wpar ] [ --wpar-warning=name=limit ] [ --wpar-critical=name=limit ]\n");
+ 	printf ("     [ -h ] [ -v ] [ -V ]\n");
+ 	printf (" %s --daemon [ -i=interval ] [ --align ] [ --realtime ] [ --bind=cpu ] [ -v ]\n", progname);
+	printf (" %s --stream | --count=count [ -i=interval ] [ thresholds ] [ --sample-ms=milliseconds ]\n", progname);
+	printf ("     [ --realtime ] [ --bind=cpu ]\n\n");
 }
 
 void print_help (void)
@@ -337,8 +2165,146 @@ void print_help (void)
 	printf ("    %s\n", _("Exit with CRITICAL status if number of free system pool cpus is lower"));
 	printf ("    %s\n", _("than PERCENT of available cpus"));
 	printf ("\n");
+	printf (" %s\n", "--physc-user-warning=VALUE, --physc-user-critical=VALUE");
+	printf (" %s\n", "--physc-sys-warning=VALUE, --physc-sys-critical=VALUE");
+	printf (" %s\n", "--physc-wait-warning=VALUE, --physc-wait-critical=VALUE");
+	printf (" %s\n", "--physc-idle-warning=VALUE, --physc-idle-critical=VALUE");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the physical CPUs consumed in user,"));
+	printf ("    %s\n", _("system, I/O wait or idle mode are higher than VALUE"));
+	printf (" %s\n", "--ent-used-spurr-warning=VALUE, --ent-used-spurr-critical=VALUE");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the frequency scaled consumption"));
+	printf ("    %s\n", _("(SPURR) is higher than VALUE"));
+	printf (" %s\n", "--freq-ratio-warning=VALUE, --freq-ratio-critical=VALUE");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the effective frequency ratio"));
+	printf ("    %s\n", _("(SPURR/PURR) is lower than VALUE, e.g. 0.9 in power saving mode"));
+	printf (" %s\n", "--scaled");
+	printf ("    %s\n", _("Use the frequency scaled consumption (SPURR) for ent_used, vcpu_busy and"));
+	printf ("    %s\n", _("the -ec, -ew, -vbw and -vbc checks. The PURR consumption is the sum of the"));
+	printf ("    %s\n", _("physc_* values"));
+	printf (" %s\n", "--donated-idle-warning=VALUE, --donated-idle-critical=VALUE");
+	printf (" %s\n", "--donated-busy-warning=VALUE, --donated-busy-critical=VALUE");
+	printf (" %s\n", "--stolen-idle-warning=VALUE, --stolen-idle-critical=VALUE");
+	printf (" %s\n", "--stolen-busy-warning=VALUE, --stolen-busy-critical=VALUE");
+	printf ("    %s\n", _("Dedicated donating LPARs only: exit with WARNING or CRITICAL status if"));
+	printf ("    %s\n", _("the idle or busy physical CPUs donated to the pool or stolen by the"));
+	printf ("    %s\n", _("hypervisor are higher than VALUE"));
+	printf (" %s\n", "--vcsw-invol-warning=VALUE, --vcsw-invol-critical=VALUE");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the involuntary virtual context"));
+	printf ("    %s\n", _("switches per vCPU and second are higher than VALUE"));
+	printf (" %s\n", "--hpi-warning=VALUE, --hpi-critical=VALUE");
+	printf (" %s\n", "--hpi-wait-warning=MS, --hpi-wait-critical=MS");
+	printf ("    %s\n", _("Active Memory Sharing LPARs only: exit with WARNING or CRITICAL status if"));
+	printf ("    %s\n", _("the hypervisor page-ins per second or the average wait per page-in in"));
+	printf ("    %s\n", _("milliseconds are higher than VALUE or MS"));
+	printf (" %s\n", "--pool-cap-used-warning=PERCENT, --pool-cap-used-critical=PERCENT");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the pool usage is higher than"));
+	printf ("    %s\n", _("PERCENT of the maximum pool capacity (pool_max_cap). A user defined pool"));
+	printf ("    %s\n", _("reaches its cap before its physical CPUs are busy (-pw, -pc, -pfw, -pfc)"));
+	printf (" %s\n", "--pool-share-warning=PERCENT, --pool-share-critical=PERCENT");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if this LPAR consumes more than"));
+	printf ("    %s\n", _("PERCENT of the pool usage"));
+	printf (" %s\n", "--fair-share-excess-warning=VALUE, --fair-share-excess-critical=VALUE");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the consumed CPUs are more than"));
+	printf ("    %s\n", _("VALUE above the projected share in a fully contended pool (fair_share)"));
+	printf (" %s\n", "--throttled-warning=PERCENT, --throttled-critical=PERCENT");
+	printf ("    %s\n", _("Capped LPARs only: exit with WARNING or CRITICAL status if the LPAR was"));
+	printf ("    %s\n", _("throttled at its entitlement for more than PERCENT of the interval."));
+	printf ("    %s\n", _("Use --sample-ms, without it the whole interval counts as throttled or not"));
+	printf (" %s\n", "--top=INTEGER");
+	printf ("    %s\n", _("Snapshot the CPU time of all processes with the partition counters and add"));
+	printf ("    %s\n", _("the INTEGER (1..20) processes that consumed most CPUs in the interval to the"));
+	printf ("    %s\n", _("output when the check is not OK"));
+	printf (" %s\n", "--wpar");
+	printf ("    %s\n", _("Measure the consumption of all WPARs in the same interval. One line per"));
+	printf ("    %s\n", _("WPAR follows the first line of the output"));
+	printf (" %s\n", "--wpar-warning=NAME=VALUE, --wpar-critical=NAME=VALUE");
+	printf (" %s\n", "--wpar-warning=NAME=PERCENT%, --wpar-critical=NAME=PERCENT%");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if WPAR NAME consumes more than VALUE"));
+	printf ("    %s\n", _("physical CPUs or PERCENT of the entitlement of the LPAR, or outside of a"));
+	printf ("    %s\n", _("range of them (see below). NAME * applies to all WPARs without own"));
+	printf ("    %s\n", _("thresholds. Can be given for many WPARs, implies --wpar"));
+	printf (" %s\n", "--cpu-scan");
+	printf ("    %s\n", _("Scan the PURR counters of all logical CPUs in the same interval and add"));
+	printf ("    %s\n", _("lcpu_busy_max, lcpu_busy_min, lcpu_busy_stddev (PURR consumption of a logical"));
+	printf ("    %s\n", _("CPU in percent of the interval) and lcpu_saturated (logical CPUs 95% busy or"));
+	printf ("    %s\n", _("more) to the performance data"));
+	printf (" %s\n", "--lcpu-busy-max-warning=PERCENT, --lcpu-busy-max-critical=PERCENT");
+	printf (" %s\n", "--lcpu-busy-stddev-warning=PERCENT, --lcpu-busy-stddev-critical=PERCENT");
+	printf (" %s\n", "--lcpu-saturated-warning=COUNT, --lcpu-saturated-critical=COUNT");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the busiest logical CPU, the imbalance"));
+	printf ("    %s\n", _("or the number of saturated logical CPUs is higher than the threshold."));
+	printf (" %s\n", "--vcpu-folded-warning=COUNT, --vcpu-folded-critical=COUNT");
+	printf (" %s\n", "--smt-spread-warning=PERCENT, --smt-spread-critical=PERCENT");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if more than COUNT vCPUs were folded"));
+	printf ("    %s\n", _("(too many vCPUs) or the mean busy spread between the SMT threads of the"));
+	printf ("    %s\n", _("unfolded vCPUs is higher than PERCENT"));
+	printf ("    %s\n", _("Need --cpu-scan"));
+	printf (" %s\n", "--runq-warning=VALUE, --runq-critical=VALUE");
+	printf (" %s\n", "--runq-vcpu-warning=VALUE, --runq-vcpu-critical=VALUE");
+	printf (" %s\n", "--runq-lcpu-warning=VALUE, --runq-lcpu-critical=VALUE");
+	printf (" %s\n", "--swpq-warning=VALUE, --swpq-critical=VALUE");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the runnable threads, in total, per"));
+	printf ("    %s\n", _("vCPU or per logical CPU, or the threads waiting for memory are higher than"));
+	printf ("    %s\n", _("VALUE. The kernel adds the queues once per second, use -i 5 or longer."));
+	printf ("    %s\n", _("Measured with --cpu-scan or a threshold"));
+	printf (" %s\n", "--ame-physc-warning=VALUE, --ame-physc-critical=VALUE");
+	printf (" %s\n", "--ame-ent-warning=PERCENT, --ame-ent-critical=PERCENT");
+	printf (" %s\n", "--ame-deficit-warning=MB, --ame-deficit-critical=MB");
+	printf ("    %s\n", _("Active Memory Expansion LPARs only: exit with WARNING or CRITICAL status if"));
+	printf ("    %s\n", _("the CPUs spent on memory compression, their percentage of ent_used or the"));
+	printf ("    %s\n", _("memory deficit of the expansion factor are higher than the threshold"));
+	printf (" %s\n", "--iome-used-warning=PERCENT, --iome-used-critical=PERCENT");
+	printf ("    %s\n", _("Active Memory Sharing LPARs only: exit with WARNING or CRITICAL status if"));
+	printf ("    %s\n", _("more than PERCENT of the I/O entitled memory is in use"));
+	printf ("\n");
 	printf (" %s\n", "-i, --interval=INTEGER");
-	printf ("    %s\n", _("measurement interval in INTEGER seconds (1..30). Default is 1"));
+	printf ("    %s\n", _("measurement interval in INTEGER seconds (1..30, with --daemon 1..900). Default is 1"));
+	printf (" %s\n", "--state-file=FILE");
+	printf ("    %s\n", _("Save the counters of each run in FILE and measure from the counters of"));
+	printf ("    %s\n", _("the last run, no sleep necessary when the last run is at least interval"));
+	printf ("    %s\n", _("seconds ago. FILE can be shared by all checks of the LPAR running as the"));
+	printf ("    %s\n", _("same user, symbolic links and files of other users are not used"));
+	printf (" %s\n", "--state-max-age=INTEGER");
+	printf ("    %s\n", _("Ignore the state file when older than INTEGER seconds. Default is 300"));
+	printf (" %s\n", "--sample-ms=INTEGER");
+	printf ("    %s\n", _("Sample every INTEGER milliseconds (10..1000) during the interval and add"));
+	printf ("    %s\n", _("min, p50, p95, p99 and max of entitlement, pool usage and pool free"));
+	printf ("    %s\n", _("capacity of these slices to the performance data"));
+	printf (" %s\n", "--statistic=mean|p50|p95|p99|max");
+	printf ("    %s\n", _("Check entitlement, vCPU and pool thresholds against this statistic of the"));
+	printf ("    %s\n", _("slices instead of the mean of the interval. Pool free thresholds use the"));
+	printf ("    %s\n", _("mirrored value (p5, p1, min). Needs --sample-ms, default is mean"));
+	printf (" %s\n", "--adaptive");
+	printf ("    %s\n", _("Stop sampling before the end of the interval as soon as no threshold"));
+	printf ("    %s\n", _("is within the confidence interval of the slices. Uses --sample-ms,"));
+	printf ("    %s\n", _("default is 200, and adds the measured period as window to the perfdata"));
+	printf (" %s\n", "--align");
+	printf ("    %s\n", _("Start the measurement at the next multiple of interval seconds of the"));
+	printf ("    %s\n", _("wall clock, e.g. :00, :05, :10 with -i 5. Checks on different LPARs"));
+	printf ("    %s\n", _("measure the same period. Adds the measured period as window to the perfdata"));
+	printf (" %s\n", "--timeout=INTEGER");
+	printf ("    %s\n", _("Return within INTEGER seconds, set it to the nagios plugin timeout."));
+	printf ("    %s\n", _("The measurement is cut 1 second before and shortened=1 is added to the"));
+	printf ("    %s\n", _("perfdata, UNKNOWN when even the first perfstat call does not return"));
+	printf (" %s\n", "--daemon");
+	printf ("    %s\n", _("Run as sampler daemon, sample every second and publish the results of the"));
+	printf ("    %s\n", _("last interval (up to 900 seconds) and of the last 1, 5 and 15 minutes in"));
+	printf ("    %s\n", _("shared memory. Does not return, start it e.g. from inittab"));
+	printf (" %s\n", "--shm");
+	printf ("    %s\n", _("Check the latest results of the sampler daemon, no sampling and no sleep"));
+	printf (" %s\n", "--window=1m|5m|15m");
+	printf ("    %s\n", _("Check the results of the sampler daemon over the last 1, 5 or 15 minutes"));
+	printf ("    %s\n", _("instead of its last interval. Needs --shm"));
+	printf (" %s\n", "--stream");
+	printf ("    %s\n", _("Print one line with timestamp, state and performance data per interval"));
+	printf ("    %s\n", _("until killed, thresholds are optional"));
+	printf (" %s\n", "--count=INTEGER");
+	printf ("    %s\n", _("Like --stream, but stop after INTEGER intervals"));
+	printf (" %s\n", "--realtime");
+	printf ("    %s\n", _("Daemon and stream only: run with fixed priority 50 and locked memory to"));
+	printf ("    %s\n", _("keep sampling in time on a saturated LPAR. Needs root"));
+	printf (" %s\n", "--bind=INTEGER");
+	printf ("    %s\n", _("Daemon and stream only: bind to logical CPU INTEGER"));
 	printf (" %s\n", "-x, -strict, --strict");
 	printf ("    %s\n", _("Exit with CRITICAL status if pool or entitlement values are obviously wrong"));
 	printf ("    %s\n", _("e.g. pool sizes or usage values are 0, number of pool cpus is higher than"));
@@ -357,6 +2323,13 @@ void print_help (void)
 	printf ("%s\n", _("PERCENT is a positive integer number in the range 1..100"));
 	printf ("%s\n", _("PERCENT in entitlement arguments are in the range 1..2000"));
 	printf ("\n");
+	printf ("%s\n", _("Instead of a VALUE or PERCENT the threshold options -ec, -ew, -vbw, -vbc, -pw, -pc,"));
+	printf ("%s\n", _("-pfw, -pfc, -sw, -sc, -sfw, -sfc, --METRIC-* and --wpar-* accept a nagios range"));
+	printf ("%s\n", _("[@][start:][end], followed by % for a percentage. The check alerts outside of"));
+	printf ("%s\n", _("start..end, or inside with @. start ~ is minus infinity, a missing end is infinity."));
+	printf ("%s\n", _("A bare VALUE or PERCENT keeps its old meaning, the free options and --freq-ratio-*"));
+	printf ("%s\n", _("alert below and all others above it"));
+	printf ("\n");
 	printf ("%s\n", _("Warning and critical checks can be configured independently, critical checks"));
         printf ("%s\n", _("without warnings are possible"));
 	printf ("%s\n", _("Exactly one PERCENT and one VALUE for each option is possible, see examples"));
@@ -366,6 +2339,9 @@ void print_help (void)
 	printf ("%s\n", _("Checks entitlement usage at 2.0 and 2.5 or 200%:"));
 	printf ("%s\n", _("check_ent_pools -ew 2.0 -ec 2.5 -ec 200%"));
 	printf ("\n");
+	printf ("%s\n", _("Warns when the pool has less than 2.0 CPUs free and the LPAR uses 0.5 to 1.0 CPUs:"));
+	printf ("%s\n", _("check_ent_pools -pfw 2.0: -ew @0.5:1.0"));
+	printf ("\n");
 	printf ("%s\n", _("Checks entitlement usage at 100% and 300%:"));
 	printf ("%s\n", _("check_ent_pools -ew 100% -ec 300%"));
 	printf ("\n");
@@ -377,11 +2353,140 @@ void print_help (void)
 	printf ("%s\n", _("system pool CPU:"));
 	printf ("%s\n", _("check_ent_pools -sw 20 -sc 24 -sfw 2.5 -sfc 1 -sfc 98%"));
 
-	printf ("\n");
-	printf ("This nagios plugin comes with ABSOLUTELY NO WARRANTY. You may redistribute\n");
-	printf ("copies of the plugin under the terms of the GNU General Public License.\n");
-	printf ("For more information about these matters, see the file named COPYING.\n");
+	printf ("\n");
+	printf ("This nagios plugin comes with ABSOLUTELY NO WARRANTY. You may redistribute\n");
+	printf ("copies of the plugin under the terms of the GNU General Public License.\n");
+	printf ("For more information about these matters, see the file named COPYING.\n");
+
+}
+
+/* WPAR threshold NAME=RANGE or NAME=RANGE% */
+void parse_wpar_threshold(char *option, char *arg, int critical)
+{
+	struct wpar_threshold *t;
+	char *value = strchr(arg, '=');
+	struct range *threshold;
+	char range[64];
+	int i, percent;
+
+	if (!value || value == arg || value - arg > MAXCORRALNAMELEN) {
+		printf("ERROR: --%s %s has to be NAME=RANGE or NAME=RANGE%%!\n", option, arg);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	*value++ = 0;
+	for (i = 0; i < wpar_threshold_count && strcmp(wpar_thresholds[i].name, arg); i++)
+		;
+	if (i == wpar_threshold_count) {
+		if (wpar_threshold_count == WPAR_THRESHOLDS) {
+			printf("ERROR: Too many WPAR thresholds, maximum %d WPARs!\n", WPAR_THRESHOLDS);
+			exit(STATE_UNKNOWN);
+		}
+		strcpy(wpar_thresholds[wpar_threshold_count++].name, arg);
+	}
+	t = &wpar_thresholds[i];
+	percent = *value && value[strlen(value)-1] == '%';
+	if (percent) {
+		value[strlen(value)-1] = 0;	/* remove the % */
+		threshold = critical ? &t->critical_pct : &t->warning_pct;
+	} else
+		threshold = critical ? &t->critical : &t->warning;
+	if (threshold->set) {
+		printf("ERROR: --%s for WPAR %s already set! Don't specify more than once!\n", option, arg);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	snprintf(range, sizeof(range), "%s", value);
+	if (!parse_range(range, FALSE, threshold)) {
+		printf("ERROR: --%s %s=%s is no valid range! Use [@][start:][end], start ~ is minus infinity\n", option, arg, value);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	wpar_mode = TRUE;
+	if (verbose) { printf("threshold WPAR %s %s=%s%.2f:%.2f%s\n", arg, option, threshold->inside ? "@" : "",
+				threshold->start, threshold->end, percent ? "%" : ""); }
+}
+
+/* threshold -ew, -ec, -vbw, -vbc, -pw, -pc, -pfw, -pfc, -sw, -sc, -sfw or -sfc, only once each for value and
+ * percentage (PERCENT% or a range with %). value is NULL when only percentages are allowed, lower when a bare
+ * number is a lower limit. Bare numbers are checked as before ranges were supported. */
+void parse_threshold(char *option, char *arg, int lower, struct range *value, struct range *pct)
+{
+	char range[64], *from, *to;
+	struct range *r;
+	int percent;
+
+	/* the range without % */
+	for (from = arg, to = range, percent = FALSE; *from && to < range + sizeof(range) - 1; from++)
+		if (*from == '%')
+			percent = TRUE;
+		else
+			*to++ = *from;
+	*to = 0;
+
+	r = percent ? pct : value;
+	if (r == NULL) {
+		printf("ERROR: -%s %s out of range: Allowed 1%%..100%%\n", option, arg);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (r->set) {
+		printf("ERROR: -%s already set! Don't specify more than once!\n", option);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (!strpbrk(range, "@:~")) {
+		/* pct ranges from 1 to 100%, entitlement from 1 to 2000% for shared LPARs
+		 * maximum percentage is 2000% only on LPARs with minimum entitlement of 0.05 per virtual processor */
+		if (r == &entitlement_critical_pct || r == &entitlement_warning_pct) {
+			if (!is_intpercent_ent(range)) {
+				printf("ERROR: -%s %s out of range! Allowed 1%%..2000%%\n", option, arg);
+				print_usage();
+				exit(STATE_UNKNOWN);
+			}
+		} else if (percent) {
+			if (!is_intpercent(range)) {
+				printf("ERROR: -%s %s out of range! Allowed 1%%..100%%\n", option, arg);
+				print_usage();
+				exit(STATE_UNKNOWN);
+			}
+		} else {
+			if (!is_positive(range)) {
+				printf("ERROR: -%s %s out of range: Argument has to be >0 !\n", option, arg);
+				print_usage();
+				exit(STATE_UNKNOWN);
+			}
+			/* we use only 1 digit after the comma, remove all the others */
+			snprintf(range, sizeof(range), "%.1f", (double)(int)(atof(range)*10)/10);
+		}
+	}
+	if (!parse_range(range, lower, r)) {
+		printf("ERROR: -%s %s is no valid range! Use [@][start:][end], start ~ is minus infinity\n", option, arg);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (verbose) { printf("threshold -%s=%s%.2f:%.2f%s\n", option, r->inside ? "@" : "", r->start, r->end, percent ? "%" : ""); }
+}
+
+/* threshold of an additional metric, a range or a bare number in the direction of the metric, only once */
+void parse_metric_threshold(int c, char *arg)
+{
+	struct metric *m = &metrics[(c - OPT_METRIC) / 2];
+	struct range *r = (c - OPT_METRIC) % 2 ? &m->critical : &m->warning;
+	char *level = (c - OPT_METRIC) % 2 ? "critical" : "warning";
 
+	if (r->set) {
+		printf("ERROR: --%s-%s already set! Don't specify more than once!\n", m->option, level);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (!parse_range(arg, m->lower, r)) {
+		printf("ERROR: --%s-%s %s is no valid range! Use [@][start:][end], start ~ is minus infinity\n", m->option, level, arg);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	metric_check_requested+=1;
+	if (verbose) { printf("threshold %s_%s=%s%.2f:%.2f\n", m->name, level, r->inside ? "@" : "", r->start, r->end); }
 }
 
 /* main */
@@ -419,6 +2524,56 @@ int main(int argc, char* argv[])
 	{"x",                    no_argument,       0, 'x'},
 	{"i",                    required_argument, 0, 'i'},
 	{"interval",             required_argument, 0, 'i'},
+	{"state-file",           required_argument, 0, OPT_STATE_FILE},
+	{"state-max-age",        required_argument, 0, OPT_STATE_MAX_AGE},
+	{"daemon",               no_argument,       0, OPT_DAEMON},
+	{"shm",                  no_argument,       0, OPT_SHM},
+	{"window",               required_argument, 0, OPT_WINDOW},
+	{"sample-ms",            required_argument, 0, OPT_SAMPLE_MS},
+	{"statistic",            required_argument, 0, OPT_STATISTIC},
+	{"stream",               no_argument,       0, OPT_STREAM},
+	{"count",                required_argument, 0, OPT_COUNT},
+	{"adaptive",             no_argument,       0, OPT_ADAPTIVE},
+	{"align",                no_argument,       0, OPT_ALIGN},
+	{"timeout",              required_argument, 0, OPT_TIMEOUT},
+	{"realtime",             no_argument,       0, OPT_REALTIME},
+	{"bind",                 required_argument, 0, OPT_BIND},
+	{"cpu-scan",             no_argument,       0, OPT_CPU_SCAN},
+	{"scaled",               no_argument,       0, OPT_SCALED},
+	{"top",                  required_argument, 0, OPT_TOP},
+	{"wpar",                 no_argument,       0, OPT_WPAR},
+	{"wpar-warning",         required_argument, 0, OPT_WPAR_WARNING},
+	{"wpar-critical",        required_argument, 0, OPT_WPAR_CRITICAL},
+	METRIC_OPTIONS("physc-user", M_PHYSC_USER),
+	METRIC_OPTIONS("physc-sys", M_PHYSC_SYS),
+	METRIC_OPTIONS("physc-wait", M_PHYSC_WAIT),
+	METRIC_OPTIONS("physc-idle", M_PHYSC_IDLE),
+	METRIC_OPTIONS("donated-idle", M_DONATED_IDLE),
+	METRIC_OPTIONS("donated-busy", M_DONATED_BUSY),
+	METRIC_OPTIONS("stolen-idle", M_STOLEN_IDLE),
+	METRIC_OPTIONS("stolen-busy", M_STOLEN_BUSY),
+	METRIC_OPTIONS("vcsw-invol", M_VCSW_INVOL),
+	METRIC_OPTIONS("hpi", M_HPI),
+	METRIC_OPTIONS("hpi-wait", M_HPI_WAIT),
+	METRIC_OPTIONS("pool-cap-used", M_POOL_CAP_USED_PCT),
+	METRIC_OPTIONS("pool-share", M_POOL_SHARE_PCT),
+	METRIC_OPTIONS("fair-share-excess", M_FAIR_SHARE_EXCESS),
+	METRIC_OPTIONS("throttled", M_THROTTLED_PCT),
+	METRIC_OPTIONS("lcpu-busy-max", M_LCPU_BUSY_MAX),
+	METRIC_OPTIONS("lcpu-busy-stddev", M_LCPU_BUSY_STDDEV),
+	METRIC_OPTIONS("lcpu-saturated", M_LCPU_SATURATED),
+	METRIC_OPTIONS("vcpu-folded", M_VCPU_FOLDED),
+	METRIC_OPTIONS("smt-spread", M_SMT_SPREAD),
+	METRIC_OPTIONS("ent-used-spurr", M_ENT_USED_SPURR),
+	METRIC_OPTIONS("freq-ratio", M_FREQ_RATIO),
+	METRIC_OPTIONS("runq", M_RUNQ),
+	METRIC_OPTIONS("runq-vcpu", M_RUNQ_VCPU),
+	METRIC_OPTIONS("runq-lcpu", M_RUNQ_LCPU),
+	METRIC_OPTIONS("swpq", M_SWPQ),
+	METRIC_OPTIONS("ame-physc", M_AME_PHYSC),
+	METRIC_OPTIONS("ame-ent", M_AME_ENT_PCT),
+	METRIC_OPTIONS("ame-deficit", M_AME_DEFICIT_MB),
+	METRIC_OPTIONS("iome-used", M_IOME_USED_PCT),
 	{"verbose",              no_argument,       0, 'v'},
 	{"version",              no_argument,       0, 'V'},
 	{"help",                 no_argument,       0, 'h'},
@@ -441,434 +2596,48 @@ int main(int argc, char* argv[])
 	    /* if (verbose) { printf("Option verbose selected\n"); } */
 	    break;
     	case 'e':
-	    /* if (verbose) { printf("Option entitlement-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( entitlement_critical_pct != 0 ) {
-			    printf("ERROR: -ec already set to %.0f%%! Don't specify more than once!\n",entitlement_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..2000% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    entitlement_critical_pct = (double)atoi(optarg);	/* pct ranges from 1 to 2000% for shared LPARs */
-	            /* maximum percentage is 2000% only on LPARs with minimum entitlement of 0.05 per virtual processor
-	             * effective maximum percentage decreases when entitlement is increased, this is currently not checked for sanity */
-		    if ( !(is_intpercent_ent(tmp))) {
-			    printf("ERROR: -ec %s%% out of range! Allowed 1%%..2000%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold entitlement_critical%%=%.0f%%\n",entitlement_critical_pct); }
-	    } else {
-		    if ( entitlement_critical != 0 ) {
-			    printf("ERROR: -ec already set to %.1f! Don't specify more than once!\n",entitlement_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int =(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    entitlement_critical=(double)tmp_int/10;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -ec %s out of range: Entitlement has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold entitlement_critical=%.1f\n",entitlement_critical); }
-	    } 
+	    parse_threshold("ec", optarg, FALSE, &entitlement_critical, &entitlement_critical_pct);
 	    break;
     	case 'f':
-	    /* if (verbose) { printf("Option entitlement-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( entitlement_warning_pct != 0 ) {
-			    printf("ERROR: -ew already set to %.0f%%! Don't specify more than once!\n",entitlement_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..2000% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    entitlement_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 2000% for shared LPARs */
-	            /* maximum percentage is 2000% only on LPARs with minimum entitlement of 0.05 per virtual processor
-	             * effective maximum percentage decreases when entitlement is increased, this is currently not checked for sanity */
-		    if ( !(is_intpercent_ent(tmp))) {
-			    printf("ERROR: -ew %s%% out of range! Allowed 1%%..2000%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold entitlement_warning%%=%.0f%%\n",entitlement_warning_pct); }
-	    } else {
-		    if ( entitlement_warning != 0 ) {
-			    printf("ERROR: -ew already set to %.1f! Don't specify more than once!\n",entitlement_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    entitlement_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -ew %s out of range: Entitlement has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold entitlement_warning=%.1f\n",entitlement_warning); }
-	    } 
+	    parse_threshold("ew", optarg, FALSE, &entitlement_warning, &entitlement_warning_pct);
 	    break;
     	case 'a':
-	    /* if (verbose) { printf("Option vcpu-busy-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( vcpu_busy_warning_pct != 0 ) {
-			    printf("ERROR: -vbw already set to %.0f%%! Don't specify more than once!\n",vcpu_busy_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    vcpu_busy_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -vbw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold vcpu_busy_warning%%=%.0f\n",vcpu_busy_warning_pct); }
-	    } else {
-		    /* optarg is floating value or anything else */
-		   printf("ERROR: -vbw %s out of range: Allowed 1%%..100%%\n",optarg);
-		   print_usage();
-		   exit(STATE_UNKNOWN);
-	    } 
+	    parse_threshold("vbw", optarg, FALSE, NULL, &vcpu_busy_warning_pct);
 	    break;
     	case 'b':
-	    /* if (verbose) { printf("Option vcpu-busy-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( vcpu_busy_critical_pct != 0 ) {
-			    printf("ERROR: -vbc already set to %.0f%%! Don't specify more than once!\n",vcpu_busy_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    vcpu_busy_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -vbc %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold vcpu_busy_critical%%=%.0f\n",vcpu_busy_critical_pct); }
-	    } else {
-		    /* optarg is floating value or anything else */
-		   printf("ERROR: -vbc %s out of range: Allowed 1%%..100%%\n",optarg);
-		   print_usage();
-		   exit(STATE_UNKNOWN);
-	    } 
+	    parse_threshold("vbc", optarg, FALSE, NULL, &vcpu_busy_critical_pct);
 	    break;
     	case 'p':
-	    /* if (verbose) { printf("Option pool-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( pool_critical_pct != 0 ) {
-			    printf("ERROR: -pc already set to %.0f%%! Don't specify more than once!\n",pool_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    pool_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;      /* to exit easily later if lpar mode is dedicated donating */
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -pc %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_critical%%=%.0f\n",pool_critical_pct); }
-	    } else {
-		    if ( pool_critical != 0 ) {
-			    printf("ERROR: -pc already set to %.1f! Don't specify more than once!\n",pool_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    pool_critical=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -pc %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_critical=%.1f\n",pool_critical); }
-	    } 
+	    parse_threshold("pc", optarg, FALSE, &pool_critical, &pool_critical_pct);
+	    pool_check_requested+=1;      /* to exit easily later if lpar mode is dedicated donating */
 	    break;
     	case 'q':
-	    /* if (verbose) { printf("Option pool-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( pool_warning_pct != 0 ) {
-			    printf("ERROR: -pw already set to %.0f%%! Don't specify more than once!\n",pool_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    pool_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -pw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_warning%%=%.0f\n",pool_warning_pct); }
-	    } else {
-		    if ( pool_warning != 0 ) {
-			    printf("ERROR: -pw already set to %.1f! Don't specify more than once!\n",pool_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    pool_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -pw %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_warning=%.1f\n",pool_warning); }
-	    } 
+	    parse_threshold("pw", optarg, FALSE, &pool_warning, &pool_warning_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'l':
-	    /* if (verbose) { printf("Option pool-free-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( pool_free_critical_pct != 0 ) {
-			    printf("ERROR: -pfc already set to %.0f%%! Don't specify more than once!\n",pool_free_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    pool_free_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -pfc %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_free_critical%%=%.0f\n",pool_free_critical_pct); }
-	    } else {
-		    if ( pool_free_critical != 0 ) {
-			    printf("ERROR: -pfc already set to %.1f! Don't specify more than once!\n",pool_free_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    pool_free_critical=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -pfc %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_free_critical=%.1f\n",pool_free_critical); }
-	    } 
+	    parse_threshold("pfc", optarg, TRUE, &pool_free_critical, &pool_free_critical_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'm':
-	    /* if (verbose) { printf("Option pool-free-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( pool_free_warning_pct != 0 ) {
-			    printf("ERROR: -pfw already set to %.0f%%! Don't specify more than once!\n",pool_free_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    pool_free_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -pfw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_free_warning%%=%.0f\n",pool_free_warning_pct); }
-	    } else {
-		    if ( pool_free_warning != 0 ) {
-			    printf("ERROR: -pfw already set to %.1f! Don't specify more than once!\n",pool_free_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    pool_free_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -pfw %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold pool_free_warning=%.1f\n",pool_free_warning); }
-	    } 
+	    parse_threshold("pfw", optarg, TRUE, &pool_free_warning, &pool_free_warning_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 's':
-	    /* if (verbose) { printf("Option system-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( system_warning_pct != 0 ) {
-			    printf("ERROR: -sw already set to %.0f%%! Don't specify more than once!\n",system_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    system_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -sw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_warning%%=%.0f\n",system_warning_pct); }
-	    } else {
-		    if ( system_warning != 0 ) {
-			    printf("ERROR: -sw already set to %.1f! Don't specify more than once!\n",system_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    system_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -sw %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_warning=%.1f\n",system_warning); }
-	    } 
+	    parse_threshold("sw", optarg, FALSE, &system_warning, &system_warning_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 't':
-	    /* if (verbose) { printf("Option system-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( system_critical_pct != 0 ) {
-			    printf("ERROR: -sc already set to %.0f%%! Don't specify more than once!\n",system_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    system_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -sc %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_critical%%=%.0f\n",system_critical_pct); }
-	    } else {
-		    if ( system_critical != 0 ) {
-			    printf("ERROR: -sc set to %.1f! Don't specify more than once!\n",system_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    system_critical=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -sc %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_critical=%.1f\n",system_critical); }
-	    } 
+	    parse_threshold("sc", optarg, FALSE, &system_critical, &system_critical_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'g':
-	    /* if (verbose) { printf("Option system-free-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( system_free_critical_pct != 0 ) {
-			    printf("ERROR: -sfc already set to %.0f%%! Don't specify more than once!\n",system_free_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    system_free_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: Argument %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_free_critical%%=%.0f\n",system_free_critical_pct); }
-	    } else {
-		    if ( system_free_critical != 0 ) {
-			    printf("ERROR: -sfc already set to %.1f! Don't specify more than once!\n",system_free_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    system_free_critical=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -sfc %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_free_critical=%.1f\n",system_free_critical); }
-	    } 
+	    parse_threshold("sfc", optarg, TRUE, &system_free_critical, &system_free_critical_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'k':
-	    /* if (verbose) { printf("Option system-free-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( system_free_warning_pct != 0 ) {
-			    printf("ERROR: -sfw already set to %.0f%%! Don't specify more than once!\n",system_free_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    system_free_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    pool_check_requested+=1;
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -sfw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_free_warning%%=%.0f\n",system_free_warning_pct); }
-	    } else {
-		    if ( system_free_warning != 0 ) {
-			    printf("ERROR: -sfw already set to %.1f! Don't specify more than once!\n",system_free_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    system_free_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    pool_check_requested+=1;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -sfw %s out of range: Argument has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold system_free_warning=%.1f\n",system_free_warning); }
-	    } 
+	    parse_threshold("sfw", optarg, TRUE, &system_free_warning, &system_free_warning_pct);
+	    pool_check_requested+=1;
 	    break;
     	case 'h':
 	    print_help();
@@ -877,18 +2646,131 @@ int main(int argc, char* argv[])
     	case 'i':
 	    /* if (verbose) { printf("Option interval with %s selected\n",optarg); } */
 	    if ( is_intpos(optarg)) {
-			interval = atoi (optarg);
-			if ( interval > 30 ) {
-				printf("ERROR: Interval out of range: %s! Allowed range is 1..30!\n",optarg);
-				print_usage();
-				exit(STATE_UNKNOWN);
-			}
+			interval = atoi (optarg);	/* range depends on --daemon, checked below */
 		} else {
-				printf("ERROR: Invalid value for interval: %s! Allowed range is 1..30!\n",optarg);
+				printf("ERROR: Invalid value for interval: %s! Allowed range is 1..30, 1..900 with --daemon!\n",optarg);
 				print_usage();
 				exit(STATE_UNKNOWN);
 	    }
 	    break;
+    	case OPT_STATE_FILE:
+	    state_file = optarg;
+	    if (verbose) { printf("state file %s\n",state_file); }
+	    break;
+    	case OPT_STATE_MAX_AGE:
+	    if ( is_intpos(optarg)) {
+			state_max_age = atoi (optarg);
+		} else {
+			printf("ERROR: Invalid value for state file maximum age: %s! Has to be >0!\n",optarg);
+			print_usage();
+			exit(STATE_UNKNOWN);
+	    }
+	    break;
+    	case OPT_DAEMON:
+	    daemon_mode=TRUE;
+	    break;
+    	case OPT_SHM:
+	    shm_client=TRUE;
+	    break;
+    	case OPT_WINDOW:
+	    for (shm_window = 1; shm_window < SHM_WINDOWS; shm_window++)
+		    if (strcmp(optarg, shm_window_names[shm_window]) == 0)
+			    break;
+	    if (shm_window == SHM_WINDOWS) {
+		    printf("ERROR: Invalid window: %s! Allowed are 1m, 5m, 15m!\n",optarg);
+		    print_usage();
+		    exit(STATE_UNKNOWN);
+	    }
+	    break;
+    	case OPT_SAMPLE_MS:
+	    if ( is_intpos(optarg) && atoi(optarg) >= 10 && atoi(optarg) <= 1000 ) {
+			sample_ms = atoi (optarg);
+		} else {
+			printf("ERROR: Invalid value for sample period: %s! Allowed range is 10..1000!\n",optarg);
+			print_usage();
+			exit(STATE_UNKNOWN);
+	    }
+	    break;
+    	case OPT_STATISTIC:
+	    if (strcmp(optarg, "mean") == 0)
+		    statistic = 0;
+	    else if (strcmp(optarg, "p50") == 0)
+		    statistic = 50;
+	    else if (strcmp(optarg, "p95") == 0)
+		    statistic = 95;
+	    else if (strcmp(optarg, "p99") == 0)
+		    statistic = 99;
+	    else if (strcmp(optarg, "max") == 0)
+		    statistic = 100;
+	    else {
+		    printf("ERROR: Invalid statistic: %s! Allowed are mean, p50, p95, p99, max!\n",optarg);
+		    print_usage();
+		    exit(STATE_UNKNOWN);
+	    }
+	    break;
+    	case OPT_ADAPTIVE:
+	    adaptive=TRUE;
+	    break;
+    	case OPT_ALIGN:
+	    align=TRUE;
+	    break;
+    	case OPT_CPU_SCAN:
+	    cpu_scan=TRUE;
+	    break;
+    	case OPT_SCALED:
+	    scaled=TRUE;
+	    break;
+    	case OPT_WPAR:
+	    wpar_mode=TRUE;
+	    break;
+    	case OPT_WPAR_WARNING:
+	    parse_wpar_threshold("wpar-warning", optarg, FALSE);
+	    break;
+    	case OPT_WPAR_CRITICAL:
+	    parse_wpar_threshold("wpar-critical", optarg, TRUE);
+	    break;
+    	case OPT_TOP:
+	    if ( is_integer(optarg) && atoi(optarg) >= 1 && atoi(optarg) <= TOP_MAX ) {
+			top_count = atoi (optarg);
+		} else {
+			printf("ERROR: Invalid number of top consumers: %s! Has to be 1..%d!\n",optarg,TOP_MAX);
+			print_usage();
+			exit(STATE_UNKNOWN);
+	    }
+	    break;
+    	case OPT_TIMEOUT:
+	    if ( is_intpos(optarg) && atoi(optarg) >= 2 ) {
+			timeout = atoi (optarg);
+		} else {
+			printf("ERROR: Invalid value for timeout: %s! Has to be >=2!\n",optarg);
+			print_usage();
+			exit(STATE_UNKNOWN);
+	    }
+	    break;
+    	case OPT_REALTIME:
+	    realtime=TRUE;
+	    break;
+    	case OPT_BIND:
+	    if ( is_integer(optarg) && atoi(optarg) >= 0 ) {
+			bind_cpu = atoi (optarg);
+		} else {
+			printf("ERROR: Invalid logical CPU: %s! Has to be >=0!\n",optarg);
+			print_usage();
+			exit(STATE_UNKNOWN);
+	    }
+	    break;
+    	case OPT_STREAM:
+	    stream_count = 0;
+	    break;
+    	case OPT_COUNT:
+	    if ( is_intpos(optarg)) {
+			stream_count = atoi (optarg);
+		} else {
+			printf("ERROR: Invalid value for count: %s! Has to be >0!\n",optarg);
+			print_usage();
+			exit(STATE_UNKNOWN);
+	    }
+	    break;
     	case 'x':
 	    /* if (verbose) { printf("Option strict selected\n"); } */
 	    strict=TRUE;
@@ -897,73 +2779,166 @@ int main(int argc, char* argv[])
 	    print_help();
 	    exit(0);
 	    break;
+    	default:
+	    /* thresholds of the additional metrics */
+	    if (c >= OPT_METRIC && c < OPT_METRIC + 2 * METRICS)
+		    parse_metric_threshold(c, optarg);
+	    break;
 
     	}
     }
 
-    /* check if either one monitor option is used
+    /* a check has to finish before the nagios timeout, the daemon keeps 15 minutes of samples */
+    if (interval > (daemon_mode ? WINDOW_RING - 1 : 30)) {
+	    printf("ERROR: Interval out of range: %d! Allowed range is 1..30, 1..900 with --daemon!\n", interval);
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
+    if (statistic != 0 && !sample_ms) {
+	    printf("ERROR: --statistic needs --sample-ms!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
+    if (stream_count >= 0 && (shm_client || daemon_mode)) {
+	    printf("ERROR: --stream and --count can't be used with --shm or --daemon!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
+    if (adaptive && (stream_count >= 0 || shm_client || daemon_mode)) {
+	    printf("ERROR: --adaptive can't be used with --stream, --count, --shm or --daemon!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
+    /* adaptive sampling decides after every slice */
+    if (adaptive && !sample_ms)
+	    sample_ms = ADAPTIVE_SAMPLE_MS;
+
+    /* the run queue comes with the logical CPU scan or when it is checked */
+    for (c = M_RUNQ; c <= M_SWPQ; c++)
+	    if (cpu_scan || metrics[c].warning.set || metrics[c].critical.set)
+		    runq_scan = TRUE;
+
+    if ((cpu_scan || runq_scan || top_count || wpar_mode) && (stream_count >= 0 || shm_client || daemon_mode)) {
+	    printf("ERROR: --cpu-scan, --top, --wpar and run queue thresholds can't be used with --stream, --count, --shm or --daemon!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
+    /* the state file keeps only the partition counters of one plain check */
+    if (state_file && (stream_count >= 0 || shm_client || daemon_mode || sample_ms || align ||
+		       cpu_scan || runq_scan || top_count || wpar_mode)) {
+	    printf("ERROR: --state-file can't be used with --stream, --count, --shm, --daemon, --sample-ms, --adaptive, --align, --cpu-scan, --top, --wpar or run queue thresholds!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
+    if (scaled && (shm_client || daemon_mode)) {
+	    printf("ERROR: --scaled can't be used with --shm or --daemon!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
+    if (shm_window && !shm_client) {
+	    printf("ERROR: --window needs --shm!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
+    if (timeout && (stream_count >= 0 || daemon_mode)) {
+	    printf("ERROR: --timeout can't be used with --stream, --count or --daemon!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
+    if ((realtime || bind_cpu >= 0) && stream_count < 0 && !daemon_mode) {
+	    printf("ERROR: --realtime and --bind need --daemon, --stream or --count!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+    if (realtime || bind_cpu >= 0)
+	    make_realtime();
+
+    /* the sampler daemon needs no thresholds */
+    if (daemon_mode)
+	run_sampler();
+
+    /* check if either one monitor option is used, streaming prints the values anyway
      * you can mix as many options as you want... even if it doesn't make sense at all */
-    if ( entitlement_critical+
-		    entitlement_critical_pct+
-		    entitlement_warning +
-		    entitlement_warning_pct +
-		    vcpu_busy_warning_pct +
-		    vcpu_busy_critical_pct +
-		    pool_critical + pool_warning +
-		    pool_critical_pct + pool_warning_pct +
-		    pool_free_critical + pool_free_warning +
-		    pool_free_critical_pct + pool_free_warning_pct +
-		    system_critical + system_warning +
-		    system_critical_pct + system_warning_pct +
-		    system_free_critical + system_free_warning +
-		    system_free_critical_pct + system_free_warning_pct == 0 ) {
-	    printf("ERROR: Specify at least on option -ew, -ec, -vbw, vbc, -pw, -pc, -pfw, -pfc, -sw, -sc, -sfw, -sfc!\n");
+    if ( stream_count < 0 &&
+	 entitlement_critical.set +
+		    entitlement_critical_pct.set +
+		    entitlement_warning.set +
+		    entitlement_warning_pct.set +
+		    vcpu_busy_warning_pct.set +
+		    vcpu_busy_critical_pct.set +
+		    pool_critical.set + pool_warning.set +
+		    pool_critical_pct.set + pool_warning_pct.set +
+		    pool_free_critical.set + pool_free_warning.set +
+		    pool_free_critical_pct.set + pool_free_warning_pct.set +
+		    system_critical.set + system_warning.set +
+		    system_critical_pct.set + system_warning_pct.set +
+		    system_free_critical.set + system_free_warning.set +
+		    system_free_critical_pct.set + system_free_warning_pct.set +
+		    metric_check_requested + wpar_threshold_count == 0 ) {
+	    printf("ERROR: Specify at least on option -ew, -ec, -vbw, vbc, -pw, -pc, -pfw, -pfc, -sw, -sc, -sfw, -sfc\n");
+	    printf("       or a threshold of the additional metrics!\n");
 	    print_usage();
 	    exit(STATE_UNKNOWN);
     }
 
     /* 2 structures for difference calculation */
     perfstat_partition_total_t last_lparstats, lparstats;
+    struct sample_clock last_clock, clock;
+
+    /* counters of the last run from the state file */
+    perfstat_partition_total_t saved_lparstats;
+    time_t saved_time;
+    double saved_age=-1;
+    char *reason;
+
+    if (shm_client) {
+	/* results of the sampler daemon */
+	read_shm_snapshot();
+    } else {
+	if (timeout)
+		set_deadline();
+
+	if (cpu_scan)
+		init_cpu_scan();
+
+	/* the measurement period starts now or at the next interval boundary */
+	if (align)
+		wait_for_boundary();
+	else
+		align_start = wallclock();
 
-    /* API variables and helpers */
-    u_longlong_t last_time_base;
-    u_longlong_t last_pcpu_user, last_pcpu_sys, last_pcpu_idle, last_pcpu_wait;
-    u_longlong_t last_pool_busy_time, last_shcpu_busy_time;
-    u_longlong_t last_pool_idle_time = 0;
-
-    u_longlong_t dlt_pcpu_user, dlt_pcpu_sys, dlt_pcpu_idle, dlt_pcpu_wait;
-    u_longlong_t dlt_pool_busy_time, dlt_shcpu_busy_time;
-    u_longlong_t delta_time_base;
-    u_longlong_t delta_purr;
-    u_longlong_t shcpus_in_sys=0;
-    double pool_busy_time=0, pool_busy_time_pct=0, shcpu_busy_time=0, shcpu_busy_time_pct=0;
-    double shcpu_free_time=0, shcpu_free_time_pct=0;
-    double pool_free_time=0, pool_free_time_pct=0;
-    double phys_proc_consumed=0, entitlement=0, percent_ent=0, vcpu_busy=0;
-    int pool_id;
-    int phys_cpus_pool=0;
-    int max_entitlement=0;
-
-    /* retrieve the logical partition metrics */
-    if (!perfstat_partition_total(NULL, &last_lparstats, sizeof(perfstat_partition_total_t), 1)) {
-        	printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+	/* retrieve the logical partition metrics */
+	if (!sample_partition(&last_lparstats, &last_clock)) {
+		printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
 		exit(STATE_UNKNOWN);
+	}
+	sample_scans(FALSE);
+	lpar_type = last_lparstats.type;
     }
 
     /* Bail out when any pool monitoring is requested and there is no
      * pool authority enabled (HMC -> LPAR-name -> Enable performance collection
      * or from hmc command line: chsyscfg -m msys -r LPAR  -i "LPAR _id=XX,allow_perf_collection=1" */
-    if (pool_check_requested && last_lparstats.type.b.shared_enabled && !last_lparstats.type.b.pool_util_authority) {
+    if (pool_check_requested && lpar_type.b.shared_enabled && !lpar_type.b.pool_util_authority) {
 	    printf("ENT_POOLS CRITICAL Performance collection is disabled in LPAR profile! Monitoring is not possible!\n");
 	    exit(STATE_CRITICAL);
     }
 
     /* are we dedicated donating? */
-    if(last_lparstats.type.b.donate_enabled)
+    if(lpar_type.b.donate_enabled)
 	dedicated_donating = 1;
 
     /* No entitlement and pool data on dedicated LPARs */
-    if ( ! dedicated_donating && ! last_lparstats.type.b.shared_enabled ) {
+    if ( ! dedicated_donating && ! lpar_type.b.shared_enabled ) {
     	printf("ENT_POOLS UNKNOWN Entitlement and pool data not available in dedicated LPAR mode\n");
 	exit(STATE_UNKNOWN);
     }
@@ -975,157 +2950,98 @@ int main(int argc, char* argv[])
 	exit(STATE_UNKNOWN);
     }
 
-    sleep(interval);
-
-    /* retrieve the logical partition metrics... again */
-    if (!perfstat_partition_total(NULL, &lparstats, sizeof(perfstat_partition_total_t), 1)) {
-        	printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
-		exit(STATE_UNKNOWN);
-    }
-
-    /* all last_* values were set in the previous run, the deltas is what we want */
-    /* physc consists of usr+sys+wait+idle  */
-    dlt_pcpu_user  = lparstats.puser - last_lparstats.puser;
-    dlt_pcpu_sys   = lparstats.psys  - last_lparstats.psys;
-    dlt_pcpu_idle  = lparstats.pidle - last_lparstats.pidle;
-    dlt_pcpu_wait  = lparstats.pwait - last_lparstats.pwait;
-
-    delta_purr = dlt_pcpu_user + dlt_pcpu_sys + dlt_pcpu_idle + dlt_pcpu_wait;
-
-    /* delta pool usage values */
-    dlt_pool_busy_time = lparstats.pool_busy_time - last_lparstats.pool_busy_time;
-    dlt_shcpu_busy_time = lparstats.shcpu_busy_time - last_lparstats.shcpu_busy_time;
-
-    /* get pool sizes */
-    phys_cpus_pool = lparstats.phys_cpus_pool;
-    shcpus_in_sys = lparstats.shcpus_in_sys;
-
-    /* pool id of this lpar */
-    pool_id = lparstats.pool_id;
-
-    /* get entitlement of lpar */
-    entitlement = (double)lparstats.entitled_proc_capacity / 100.0 ;
+    if (stream_count >= 0)
+	run_stream(&last_lparstats, &last_clock);
+
+    if (!shm_client) {
+	/* usable counters of the last run are the start of the measurement period,
+	 * the current counters are the end, unless the last run was less than interval ago */
+	if (state_file && read_state_file(state_file, &saved_lparstats, &saved_time))
+		saved_age = state_age(&saved_lparstats, saved_time, &last_lparstats);
+
+	if (saved_age >= 0) {
+		if (verbose) { printf("Measuring from state file counters %.2f seconds ago\n", saved_age); }
+		lparstats = last_lparstats;
+		clock = last_clock;
+		last_lparstats = saved_lparstats;
+		/* saved_age comes from the timebase, the saved counters are exactly that much older */
+		last_clock.before -= saved_age;
+		last_clock.after -= saved_age;
+	}
 
-    /* get number of virtual processors = maximum entitlement */
-    max_entitlement = lparstats.online_cpus;
+	if (sample_ms) {
+		/* the last slice ends the measurement period */
+		if (!sample_slices(&last_lparstats, &last_clock, &lparstats, &clock, align_start)) {
+			printf("ENT_POOLS UNKNOWN LPAR configuration or counters changed at the end of the measurement\n");
+			exit(STATE_UNKNOWN);
+		}
+	} else if (saved_age < interval) {
+		if (saved_age >= 0)
+			sleep_until(period_end(wallclock() + interval - saved_age));
+		else if (align || deadline)
+			sleep_until(period_end(align_start + interval));
+		else
+			sleep(interval);
 
-    /* new delta timer */
-    delta_time_base = lparstats.timebase_last - last_lparstats.timebase_last;
+		/* retrieve the logical partition metrics... again */
+		if (!sample_partition(&lparstats, &clock)) {
+			printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+			exit(STATE_UNKNOWN);
+		}
+	}
+	sample_scans(TRUE);
+
+	/* partition mobility or DLPAR during the measurement: measure again with the new configuration
+	 * slices already start after the change */
+	if (!sample_ms && (reason = sample_discontinuity(&last_lparstats, &last_clock, &lparstats, &clock))) {
+		if (verbose) { printf("%s during the measurement, measuring again\n", reason); }
+		last_lparstats = lparstats;
+		last_clock = clock;
+		restart_scans();
+		align_start = wallclock();
+		sleep_until(period_end(align_start + interval));
+		if (!sample_partition(&lparstats, &clock)) {
+			printf("ENT_POOLS UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+			exit(STATE_UNKNOWN);
+		}
+		sample_scans(TRUE);
+		if ((reason = sample_discontinuity(&last_lparstats, &last_clock, &lparstats, &clock))) {
+			printf("ENT_POOLS UNKNOWN %s during the measurement\n", reason);
+			exit(STATE_UNKNOWN);
+		}
+	}
 
-    /* Physical Processor Consumed = Entitlement Consumed */
-    phys_proc_consumed = (double)delta_purr / (double)delta_time_base;
+	if (state_file)
+		write_state_file(state_file, &lparstats);
+
+	calculate_values(&last_lparstats, &lparstats);
+	calculate_throttled();
+	if (cpu_scan)
+		calculate_cpu_scan();
+	if (runq_scan)
+		calculate_runq();
+	if (wpar_mode)
+		calculate_wpars();
+	if (sample_ms)
+		apply_statistic();
+    }
 
-    /* Percentage of Entitlement Consumed */
-    percent_ent = (phys_proc_consumed / entitlement) * 100;
+    if (scaled && !metrics[M_ENT_USED_SPURR].available) {
+	printf("ENT_POOLS UNKNOWN SPURR counters are not available on this system!\n");
+	exit(STATE_UNKNOWN);
+    }
 
-    /* Percentage of vCPU busy */ 
-    vcpu_busy = (phys_proc_consumed / (double)max_entitlement) * 100;
+    /* thresholds of additional metrics that are not measured in this LPAR mode */
+    for (c = 0; c < METRICS; c++)
+	if ((metrics[c].warning.set || metrics[c].critical.set) && !metrics[c].available) {
+		printf("ENT_POOLS UNKNOWN %s is not available on this LPAR%s!\n", metrics[c].name, shm_client ? " or with --shm" : "");
+		exit(STATE_UNKNOWN);
+	}
 
     /* we run in shared LPAR mode? */
-    if (lparstats.type.b.shared_enabled) {
-
-        /* Shared LPAR with pool authority enabled -> we have pool data */
-        if (lparstats.type.b.pool_util_authority) {
-        /* Available Pool Processor (app) */
-	   pool_free_time=(double)(lparstats.pool_idle_time - last_lparstats.pool_idle_time) / (XINTFRAC*(double)delta_time_base);
-	   pool_free_time_pct=pool_free_time*100/phys_cpus_pool;
-
-           /* busy CPUs in Pool = phys_cpus_pool - app */
-	   pool_busy_time=(double)dlt_pool_busy_time/(XINTFRAC*(double)delta_time_base);
-	   pool_busy_time_pct= pool_busy_time * 100 / phys_cpus_pool;
-
-           /* busy CPUs in managed system = Shared Pool 0 usage */
-	   shcpu_busy_time=(double)dlt_shcpu_busy_time/(XINTFRAC*(double)delta_time_base);
-	   shcpu_busy_time_pct=shcpu_busy_time * 100 / (double)shcpus_in_sys;
-	   /* free CPUs in managed system = busy CPUs - shcpus_in_sys */
-	   shcpu_free_time=shcpus_in_sys - shcpu_busy_time;
-	   shcpu_free_time_pct=shcpu_free_time * 100 / (double)shcpus_in_sys;
-        }
-
-	/* Compare critical and warning values */
-	
-	/* Entitlement checks */
-	/* maximum percentage is 2000% only on LPARs with minimum entitlement of 0.05 per virtual processor
-	 * effective maximum percentage decreases when entitlement is increased, this is currently not checked for sanity */
-	temp_state=get_new_status("Entitlement percentage check", percent_ent, entitlement_warning_pct, entitlement_critical_pct);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	ent_state = max_state(ent_state, temp_state);			/* entitlement monitor state */
-
-	temp_state=get_new_status("Entitlement check", phys_proc_consumed, entitlement_warning, entitlement_critical);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	ent_state = max_state(ent_state, temp_state);			/* entitlement monitor state */
-	
-	/* vCPU busy checks */
-	temp_state=get_new_status("vCPU busy percentage check",vcpu_busy, vcpu_busy_warning_pct, vcpu_busy_critical_pct);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	vcpu_busy_state = max_state(ent_state,temp_state);		/* vcpu busy monitor state */
-
-	/* Pool usage */
-	temp_state=get_new_status("Pool usage percentage check", pool_busy_time_pct, pool_warning_pct, pool_critical_pct);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	pool_state = max_state(pool_state, temp_state);			/* pool monitor state */
-
-	temp_state=get_new_status("Pool usage check", pool_busy_time, pool_warning, pool_critical);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	pool_state = max_state(pool_state, temp_state);			/* pool monitor state */
-	
-	/* Pool free */
-	temp_state=get_new_lower_status("Pool free percentage check", pool_free_time_pct, pool_free_warning_pct, pool_free_critical_pct);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	pool_free_state = max_state(pool_free_state, temp_state);	/* pool free monitor state */
-
-	temp_state=get_new_lower_status("Pool free check", pool_free_time, pool_free_warning, pool_free_critical);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	pool_free_state = max_state(pool_free_state, temp_state);	/* pool free monitor state */
-
-	/* System pool usage */
-	temp_state=get_new_status("System pool usage percentage check", shcpu_busy_time_pct, system_warning_pct, system_critical_pct);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	syspool_state = max_state(syspool_state, temp_state);		/* system pool state */
-
-	temp_state=get_new_status("System pool usage check", shcpu_busy_time, system_warning, system_critical);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	syspool_state = max_state(syspool_state, temp_state);		/* system pool state */
-
-	/* System pool free */
-	temp_state=get_new_lower_status("System pool free percentage check", shcpu_free_time_pct, system_free_warning_pct, system_free_critical_pct);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	syspool_free_state = max_state(syspool_free_state, temp_state);	/* system pool free state */
-
-	temp_state=get_new_lower_status("System pool free check", shcpu_free_time, system_free_warning, system_free_critical);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	syspool_free_state = max_state(syspool_free_state, temp_state);	/* system pool free state */
-
-	/* when strict checking enabled, do sanity checks too */
-	if (strict) {
-		if ( phys_proc_consumed == 0 ||
-		     entitlement == 0 ||
-		     phys_cpus_pool == 0 ||
-		     pool_busy_time == 0 ||
-		     shcpus_in_sys == 0 ||
-		     shcpu_busy_time == 0 ||
-		     phys_cpus_pool > shcpus_in_sys
-		     /* more sanity checks to think about:
-		      * phys_proc_consumed > max_entitlement
-		      * pool_busy_time > phys_cpus_pool
-		      * shcpu_busy_time > shcpus_in_sys */
-		     ) {
-			if (verbose) { printf("Insane performance values detected\n" ); }
-			ent_pool_state=STATE_CRITICAL;
-		}
+    if (lpar_type.b.shared_enabled) {
 
-	}
+	check_thresholds();
 
 	/* human readable output */
 	if ( verbose ) {
@@ -1155,7 +3071,7 @@ int main(int argc, char* argv[])
 
 	}
 
-	printf("ENT_POOLS %s ent_used=%.2f(%s) ent=%.2f ent_max=%d vcpu_busy=%.2f%%(%s) pool_id=%d pool_size=%d pool_used=%.2f(%s) pool_free=%.2f(%s) syspool_size=%llu syspool_used=%.2f(%s) syspool_free=%.2f(%s) |ent_used=%.2f ent=%.2f ent_max=%d vcpu_busy=%.2f pool_id=%d pool_size=%d pool_used=%.2f pool_free=%.2f syspool_size=%llu syspool_used=%.2f syspool_free=%.2f\n",
+	printf("ENT_POOLS %s ent_used=%.2f(%s) ent=%.2f ent_max=%d vcpu_busy=%.2f%%(%s) pool_id=%d pool_size=%d pool_used=%.2f(%s) pool_free=%.2f(%s) syspool_size=%llu syspool_used=%.2f(%s) syspool_free=%.2f(%s)",
 			states[ent_pool_state],
 			phys_proc_consumed,
 			states[ent_state],
@@ -1173,19 +3089,14 @@ int main(int argc, char* argv[])
 			shcpu_busy_time,
 			states[syspool_state],
 			shcpu_free_time,
-			states[syspool_free_state],
-			phys_proc_consumed,
-			entitlement,
-			max_entitlement,
-			vcpu_busy,
-			pool_id,
-			phys_cpus_pool,
-			pool_busy_time,
-			pool_free_time,
-			shcpus_in_sys,
-			shcpu_busy_time,
-			shcpu_free_time
+			states[syspool_free_state]
 			);
+	print_metric_status();
+	print_top_consumers(ent_pool_state);
+	printf(" |");
+	print_perfdata();
+	printf("\n");
+	print_wpars();
 
 	exit(ent_pool_state);
 
@@ -1198,34 +3109,7 @@ int main(int argc, char* argv[])
     /* Dedicated LPAR with donating */
     else if ( dedicated_donating ) {
 
-	/* Entitlement checks */
-	/* the effective maximum percentage is 100% with dedicated donating, but you can still enter 2000% on the command-line
-	 * this is currently not checked for sanity :-) */
-	temp_state=get_new_status("Entitlement percentage check", percent_ent, entitlement_warning_pct, entitlement_critical_pct);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* global monitor state */
-	ent_state = max_state(ent_state,temp_state);			/* entitlement monitor state */
-
-	temp_state=get_new_status("Entitlement check", phys_proc_consumed, entitlement_warning, entitlement_critical);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* global monitor state */
-	ent_state = max_state(ent_state,temp_state);			/* entitlement monitor state */
-
-	/* vCPU busy checks */
-	temp_state=get_new_status("vCPU busy percentage check", vcpu_busy, vcpu_busy_warning_pct, vcpu_busy_critical_pct);
-
-	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
-	vcpu_busy_state = max_state(ent_state,temp_state);		/* vcpu busy monitor state */
-
-	/* when strict checking enabled, do sanity checks too */
-	if (strict) {
-		if ( phys_proc_consumed == 0 ||
-		     entitlement == 0
-		     ) {
-			if (verbose) { printf("Insane performance values detected\n" ); }
-			ent_pool_state=STATE_CRITICAL;
-		}
-	}
+	check_thresholds();
 
 	/* human readable output */
 	if ( verbose ) {
@@ -1238,18 +3122,20 @@ int main(int argc, char* argv[])
 				);
 	}
 
-	printf("ENT_POOLS %s ent_used=%.2f(%s) ent=%.2f ent_max=%d vcpu_busy=%.2f%% |ent_used=%.2f ent=%.2f ent_max=%d vcpu_busy=%.2f\n",
+	printf("ENT_POOLS %s ent_used=%.2f(%s) ent=%.2f ent_max=%d vcpu_busy=%.2f%%",
 			states[ent_pool_state],
 			phys_proc_consumed,
 			states[ent_state],
 			entitlement,
 			max_entitlement,
-			vcpu_busy,
-			phys_proc_consumed,
-			entitlement,
-			max_entitlement,
 			vcpu_busy
 	      		);
+	print_metric_status();
+	print_top_consumers(ent_pool_state);
+	printf(" |");
+	print_perfdata();
+	printf("\n");
+	print_wpars();
 
 	exit(ent_pool_state);
     }
@@ -25,6 +25,11 @@ const char *version = "1.4";
 #include <stdlib.h>
 #include <errno.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 #include <libperfstat.h>
 
 #ifndef XINTFRAC		/* for timebase calculations... */
@@ -48,20 +53,45 @@ enum {
 /* string representations of the return codes */
 char *states[5]={"OK","WARNING","CRITICAL","UNKNOWN","DEPENDENT"};
 
+/* layout and reader of the sampler daemon snapshot */
+#include "shm_snapshot.h"
+
+/* getopt return values of long options without a single character equivalent */
+enum {
+	OPT_SHM = 256,
+	OPT_WINDOW,
+	OPT_VCSW_WARNING,
+	OPT_VCSW_CRITICAL
+};
+
 /* initial state values */
 int ent_pool_state=STATE_OK, temp_state=STATE_OK;
 int vcpu_busy_state=STATE_OK;
 int ent_state=STATE_OK;
+int vcsw_state=STATE_OK;
 
 int dedicated_donating=0;	/* marker for dedicated donating mode */
 int interval=1;			/* default interval in seconds between the 2 perflib calls = monitoring period */
 int verbose=FALSE;		/* only 1 verbose level... violating the plugin recommendations here */
 int strict=FALSE;		/* additional sanity checking of various system values */
+int shm_client=FALSE;		/* take the results from the sampler daemon instead of sampling */
+int shm_window=0;		/* window of the sampler daemon results, 0 is its sampling interval */
+
+/* nagios plugin threshold ranges */
+#include "nagios_range.h"
 
 /* monitoring variables */
-double entitlement_critical_pct=0, entitlement_warning_pct=0;
-double entitlement_critical=0, entitlement_warning=0;
-double vcpu_busy_critical_pct=0, vcpu_busy_warning_pct=0;
+struct range entitlement_critical_pct, entitlement_warning_pct;
+struct range entitlement_critical, entitlement_warning;
+struct range vcpu_busy_critical_pct, vcpu_busy_warning_pct;
+struct range vcsw_invol_critical, vcsw_invol_warning;
+
+/* monitoring results, calculated from 2 perfstat samples or taken from the sampler daemon */
+perfstat_partition_type_t lpar_type;
+double vcsw_vol=0, vcsw_invol=0;	/* virtual context switches per vCPU and second */
+int vcsw_available=FALSE;		/* measured over a period with vCPUs */
+double phys_proc_consumed=0, entitlement=0, percent_ent=0, vcpu_busy=0;
+int max_entitlement=0;
 
 
 /* helper functions "stolen" from util.c and utilbase.c */
@@ -231,6 +261,97 @@ int get_new_lower_status(char *verbose_message, double value, double warn, doubl
 	return state;
 }
 
+/* calculate the monitoring results from the counters at the start (last) and the end (now)
+ * of the measurement period */
+void calculate_values(perfstat_partition_total_t *last, perfstat_partition_total_t *now)
+{
+    u_longlong_t dlt_pcpu_user, dlt_pcpu_sys, dlt_pcpu_idle, dlt_pcpu_wait;
+    u_longlong_t delta_time_base;
+    double seconds;
+    u_longlong_t delta_purr;
+
+    /* LPAR mode at the end of the measurement period */
+    lpar_type = now->type;
+
+    /* all last_* values were set in the previous run, the deltas is what we want */
+    /* physc consists of usr+sys+wait+idle  */
+    dlt_pcpu_user  = now->puser - last->puser;
+    dlt_pcpu_sys   = now->psys  - last->psys;
+    dlt_pcpu_idle  = now->pidle - last->pidle;
+    dlt_pcpu_wait  = now->pwait - last->pwait;
+
+    delta_purr = dlt_pcpu_user + dlt_pcpu_sys + dlt_pcpu_idle + dlt_pcpu_wait;
+
+    /* get entitlement of lpar */
+    entitlement = (double)now->entitled_proc_capacity / 100.0 ;
+
+    /* get number of virtual processors = maximum entitlement */
+    max_entitlement = now->online_cpus;
+
+    /* new delta timer */
+    delta_time_base = now->timebase_last - last->timebase_last;
+
+    /* virtual context switches per vCPU and second, involuntary ones are hypervisor preemptions */
+    seconds = XINTFRAC * (double)delta_time_base / 1000000000.0;
+    vcsw_available = seconds > 0 && now->online_cpus > 0;
+    if (vcsw_available) {
+	vcsw_vol = (double)(now->vol_virt_cswitch - last->vol_virt_cswitch) / seconds / (double)now->online_cpus;
+	vcsw_invol = (double)(now->invol_virt_cswitch - last->invol_virt_cswitch) / seconds / (double)now->online_cpus;
+    }
+
+    /* Physical Processor Consumed = Entitlement Consumed */
+    phys_proc_consumed = (double)delta_purr / (double)delta_time_base;
+
+    /* Percentage of Entitlement Consumed */
+    percent_ent = (phys_proc_consumed / entitlement) * 100;
+
+    /* Percentage of vCPU busy */ 
+    vcpu_busy = (phys_proc_consumed / (double)max_entitlement) * 100;
+}
+
+/* take the monitoring results from the latest consistent snapshot of the sampler daemon */
+void read_shm_snapshot(void)
+{
+	struct shm_snapshot snapshot;
+	struct shm_window *w;
+
+	copy_shm_snapshot("ENTITLEMENT", &snapshot, verbose);
+	w = &snapshot.windows[shm_window];
+	if (verbose && shm_window) { printf("Window %s covers %.0f seconds\n", shm_window_names[shm_window], w->seconds); }
+
+	lpar_type = snapshot.type;
+	max_entitlement = snapshot.max_entitlement;
+	entitlement = snapshot.entitlement;
+	phys_proc_consumed = w->phys_proc_consumed;
+	percent_ent = w->percent_ent;
+	vcpu_busy = w->vcpu_busy;
+	vcsw_vol = w->vcsw_vol;
+	vcsw_invol = w->vcsw_invol;
+	vcsw_available = w->seconds > 0;
+}
+
+/* involuntary virtual context switches in the monitor output, only when a threshold is set */
+char *vcsw_status(void)
+{
+	static char output[64];
+
+	output[0] = 0;
+	if (vcsw_invol_warning.set || vcsw_invol_critical.set)
+		snprintf(output, sizeof(output), " vcsw_invol=%.2f(%s)", vcsw_invol, states[vcsw_state]);
+	return output;
+}
+
+/* virtual context switches in the performance data, only when they were measured */
+char *vcsw_perfdata(void)
+{
+	static char output[64];
+
+	output[0] = 0;
+	if (vcsw_available)
+		snprintf(output, sizeof(output), " vcsw_vol=%.2f vcsw_invol=%.2f", vcsw_vol, vcsw_invol);
+	return output;
+}
+
 void print_version(const char *progname,const char *version)
 {
 	printf("%s v%s\n",progname,version);
@@ -240,7 +361,9 @@ void print_version(const char *progname,const char *version)
 void print_usage (void)
 {
 	printf ("%s\n", _("Usage:"));
- 	printf (" %s [ -ec=limit ] [ -ew=limit ] [ -vbw=limit ] [ -vbc=limit ] [ -i=interval ] [ -strict ] [ -h ] [ -v ] [ -V ]\n\n", progname);
+ 	printf (" %s [ -ec=limit ] [ -ew=limit ] [ -vbw=limit ] [ -vbc=limit ] [ -i=interval ] [ -strict ] [ --shm ]\n", progname);
+ 	printf ("     [ --window=1m|5m|15m ] [ --vcsw-invol-warning=limit ] [ --vcsw-invol-critical=limit ]\n");
+ 	printf ("     [ -h ] [ -v ] [ -V ]\n\n");
 }
 
 void print_help (void)
@@ -277,10 +400,19 @@ void print_help (void)
 	printf (" %s\n", "-vbc, --vpcu-busy-critical=PERCENT%");
 	printf ("    %s\n", _("Exit with CRITICAL status if entitlement usage is higher than PERCENT of"));
 	printf ("    %s\n", _("available vCPU capacity"));
+	printf (" %s\n", "--vcsw-invol-warning=VALUE, --vcsw-invol-critical=VALUE");
+	printf ("    %s\n", _("Exit with WARNING or CRITICAL status if the involuntary virtual context"));
+	printf ("    %s\n", _("switches per vCPU and second are higher than VALUE"));
 	printf ("\n");
 
 	printf (" %s\n", "-i, --interval=INTEGER");
 	printf ("    %s\n", _("measurement interval in INTEGER seconds (1..30). Default is 1"));
+	printf (" %s\n", "--shm");
+	printf ("    %s\n", _("Check the latest results of the sampler daemon (check_ent_pools --daemon),"));
+	printf ("    %s\n", _("no sampling and no sleep"));
+	printf (" %s\n", "--window=1m|5m|15m");
+	printf ("    %s\n", _("Check the results of the sampler daemon over the last 1, 5 or 15 minutes"));
+	printf ("    %s\n", _("instead of its last interval. Needs --shm"));
 	printf (" %s\n", "-x, -strict, --strict");
 	printf ("    %s\n", _("Exit with CRITICAL status if entitlement values are obviously wrong"));
 	printf ("    %s\n", _("e.g. entitlement usage values are 0, number of pool cpus is higher than"));
@@ -299,6 +431,12 @@ void print_help (void)
 	printf ("%s\n", _("PERCENT is a positive integer number in the range 1..100"));
 	printf ("%s\n", _("PERCENT in entitlement arguments are in the range 1..2000"));
 	printf ("\n");
+	printf ("%s\n", _("Instead of a VALUE or PERCENT the threshold options -ec, -ew, -vbw, -vbc and"));
+	printf ("%s\n", _("--vcsw-invol-* accept a nagios range [@][start:][end], followed by % for a"));
+	printf ("%s\n", _("percentage. The check alerts outside of start..end, or inside with @. start ~"));
+	printf ("%s\n", _("is minus infinity, a missing end is infinity. A bare VALUE or PERCENT keeps its"));
+	printf ("%s\n", _("old meaning and alerts above it"));
+	printf ("\n");
 	printf ("%s\n", _("Warning and critical checks can be configured independently, critical checks"));
         printf ("%s\n", _("without warnings are possible"));
 	printf ("%s\n", _("Exactly one PERCENT and one VALUE for each option is possible, see examples"));
@@ -319,6 +457,71 @@ void print_help (void)
 
 }
 
+/* threshold -ew, -ec, -vbw, -vbc, --vcsw-invol-warning or --vcsw-invol-critical, only once each for value
+ * and percentage (PERCENT% or a range with %). value is NULL when only percentages are allowed, pct when
+ * only values are.
+ * Bare numbers are checked as before ranges were supported. */
+void parse_threshold(char *option, char *arg, int lower, struct range *value, struct range *pct)
+{
+	char range[64], *from, *to;
+	struct range *r;
+	int percent;
+
+	/* the range without % */
+	for (from = arg, to = range, percent = FALSE; *from && to < range + sizeof(range) - 1; from++)
+		if (*from == '%')
+			percent = TRUE;
+		else
+			*to++ = *from;
+	*to = 0;
+
+	r = percent ? pct : value;
+	if (r == NULL) {
+		if (value == NULL)
+			printf("ERROR: -%s %s out of range: Allowed 1%%..100%%\n", option, arg);
+		else
+			printf("ERROR: -%s %s has to be a value, not a percentage!\n", option, arg);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (r->set) {
+		printf("ERROR: -%s already set! Don't specify more than once!\n", option);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (!strpbrk(range, "@:~")) {
+		/* pct ranges from 1 to 100%, entitlement from 1 to 2000% for shared LPARs
+		 * maximum percentage is 2000% only on LPARs with minimum entitlement of 0.05 per virtual processor */
+		if (r == &entitlement_critical_pct || r == &entitlement_warning_pct) {
+			if (!is_intpercent_ent(range)) {
+				printf("ERROR: -%s %s out of range! Allowed 1%%..2000%%\n", option, arg);
+				print_usage();
+				exit(STATE_UNKNOWN);
+			}
+		} else if (percent) {
+			if (!is_intpercent(range)) {
+				printf("ERROR: -%s %s out of range! Allowed 1%%..100%%\n", option, arg);
+				print_usage();
+				exit(STATE_UNKNOWN);
+			}
+		} else {
+			if (!is_positive(range)) {
+				printf("ERROR: -%s %s out of range: Argument has to be >0 !\n", option, arg);
+				print_usage();
+				exit(STATE_UNKNOWN);
+			}
+			/* we use only 1 digit after the comma, remove all the others */
+			snprintf(range, sizeof(range), "%.1f", (double)(int)(atof(range)*10)/10);
+		}
+	}
+	if (!parse_range(range, lower, r)) {
+		printf("ERROR: -%s %s is no valid range! Use [@][start:][end], start ~ is minus infinity\n", option, arg);
+		print_usage();
+		exit(STATE_UNKNOWN);
+	}
+	if (verbose) { printf("threshold -%s=%s%.2f:%.2f%s\n", option, r->inside ? "@" : "", r->start, r->end, percent ? "%" : ""); }
+}
+
 /* main */
 int main(int argc, char* argv[])
 {
@@ -338,6 +541,10 @@ int main(int argc, char* argv[])
 	{"x",                    no_argument,       0, 'x'},
 	{"i",                    required_argument, 0, 'i'},
 	{"interval",             required_argument, 0, 'i'},
+	{"shm",                  no_argument,       0, OPT_SHM},
+	{"window",               required_argument, 0, OPT_WINDOW},
+	{"vcsw-invol-warning",   required_argument, 0, OPT_VCSW_WARNING},
+	{"vcsw-invol-critical",  required_argument, 0, OPT_VCSW_CRITICAL},
 	{"verbose",              no_argument,       0, 'v'},
 	{"version",              no_argument,       0, 'V'},
 	{"help",                 no_argument,       0, 'h'},
@@ -360,130 +567,16 @@ int main(int argc, char* argv[])
 	    /* if (verbose) { printf("Option verbose selected\n"); } */
 	    break;
     	case 'e':
-	    /* if (verbose) { printf("Option entitlement-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( entitlement_critical_pct != 0 ) {
-			    printf("ERROR: -ec already set to %.0f%%! Don't specify more than once!\n",entitlement_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..2000% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    entitlement_critical_pct = (double)atoi(optarg);	/* pct ranges from 1 to 2000% for shared LPARs */
-	            /* maximum percentage is 2000% only on LPARs with minimum entitlement of 0.05 per virtual processor
-	             * effective maximum percentage decreases when entitlement is increased, this is currently not checked for sanity */
-		    if ( !(is_intpercent_ent(tmp))) {
-			    printf("ERROR: -ec %s%% out of range! Allowed 1%%..2000%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold entitlement_critical%%=%.0f%%\n",entitlement_critical_pct); }
-	    } else {
-		    if ( entitlement_critical != 0 ) {
-			    printf("ERROR: -ec already set to %.1f! Don't specify more than once!\n",entitlement_critical);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int =(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    entitlement_critical=(double)tmp_int/10;
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -ec %s out of range: Entitlement has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold entitlement_critical=%.1f\n",entitlement_critical); }
-	    } 
+	    parse_threshold("ec", optarg, FALSE, &entitlement_critical, &entitlement_critical_pct);
 	    break;
     	case 'f':
-	    /* if (verbose) { printf("Option entitlement-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( entitlement_warning_pct != 0 ) {
-			    printf("ERROR: -ew already set to %.0f%%! Don't specify more than once!\n",entitlement_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..2000% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    entitlement_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 2000% for shared LPARs */
-	            /* maximum percentage is 2000% only on LPARs with minimum entitlement of 0.05 per virtual processor
-	             * effective maximum percentage decreases when entitlement is increased, this is currently not checked for sanity */
-		    if ( !(is_intpercent_ent(tmp))) {
-			    printf("ERROR: -ew %s%% out of range! Allowed 1%%..2000%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold entitlement_warning%%=%.0f%%\n",entitlement_warning_pct); }
-	    } else {
-		    if ( entitlement_warning != 0 ) {
-			    printf("ERROR: -ew already set to %.1f! Don't specify more than once!\n",entitlement_warning);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is floating value */
-		    int tmp_int;
-		    tmp_int=(int)(atof(optarg)*10); /* we use only 1 digit after the comma, remove all the others */
-		    entitlement_warning=(double)tmp_int/10; /* we use only 1 digit after the comma, remove all the others */
-		    if ( !(is_positive(optarg))) {
-			    printf("ERROR: -ew %s out of range: Entitlement has to be >0 !\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold entitlement_warning=%.1f\n",entitlement_warning); }
-	    } 
+	    parse_threshold("ew", optarg, FALSE, &entitlement_warning, &entitlement_warning_pct);
 	    break;
     	case 'a':
-	    /* if (verbose) { printf("Option vcpu-busy-warning with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( vcpu_busy_warning_pct != 0 ) {
-			    printf("ERROR: -vbw already set to %.0f%%! Don't specify more than once!\n",vcpu_busy_warning_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    vcpu_busy_warning_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -vbw %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold vcpu_busy_warning%%=%.0f\n",vcpu_busy_warning_pct); }
-	    } else {
-		    /* optarg is floating value or anything else */
-		   printf("ERROR: -vbw %s out of range: Allowed 1%%..100%%\n",optarg);
-		   print_usage();
-		   exit(STATE_UNKNOWN);
-	    } 
+	    parse_threshold("vbw", optarg, FALSE, NULL, &vcpu_busy_warning_pct);
 	    break;
     	case 'b':
-	    /* if (verbose) { printf("Option vcpu-busy-critical with %s selected\n",optarg); } */
-	    if (strstr(optarg, "%")) {
-		    if ( vcpu_busy_critical_pct != 0 ) {
-			    printf("ERROR: -vbc already set to %.0f%%! Don't specify more than once!\n",vcpu_busy_critical_pct);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    /* optarg is integer 1..100% */
-		    char *tmp=optarg;
-		    tmp[strlen(tmp)-1] = 0;	/* remove last char assuming it's the % */
-		    vcpu_busy_critical_pct= (double)atoi(optarg);	/* pct ranges from 1 to 100% */
-		    if ( !(is_intpercent(tmp))) {
-			    printf("ERROR: -vbc %s%% out of range! Allowed 1%%..100%%\n",optarg);
-			    print_usage();
-			    exit(STATE_UNKNOWN);
-		    }
-		    if (verbose) { printf("threshold vcpu_busy_critical%%=%.0f\n",vcpu_busy_critical_pct); }
-	    } else {
-		    /* optarg is floating value or anything else */
-		   printf("ERROR: -vbc %s out of range: Allowed 1%%..100%%\n",optarg);
-		   print_usage();
-		   exit(STATE_UNKNOWN);
-	    } 
+	    parse_threshold("vbc", optarg, FALSE, NULL, &vcpu_busy_critical_pct);
 	    break;
     	case 'h':
 	    print_help();
@@ -504,6 +597,25 @@ int main(int argc, char* argv[])
 				exit(STATE_UNKNOWN);
 	    }
 	    break;
+    	case OPT_SHM:
+	    shm_client=TRUE;
+	    break;
+    	case OPT_VCSW_WARNING:
+	    parse_threshold("-vcsw-invol-warning", optarg, FALSE, &vcsw_invol_warning, NULL);
+	    break;
+    	case OPT_VCSW_CRITICAL:
+	    parse_threshold("-vcsw-invol-critical", optarg, FALSE, &vcsw_invol_critical, NULL);
+	    break;
+    	case OPT_WINDOW:
+	    for (shm_window = 1; shm_window < SHM_WINDOWS; shm_window++)
+		    if (strcmp(optarg, shm_window_names[shm_window]) == 0)
+			    break;
+	    if (shm_window == SHM_WINDOWS) {
+		    printf("ERROR: Invalid window: %s! Allowed are 1m, 5m, 15m!\n",optarg);
+		    print_usage();
+		    exit(STATE_UNKNOWN);
+	    }
+	    break;
     	case 'x':
 	    /* if (verbose) { printf("Option strict selected\n"); } */
 	    strict=TRUE;
@@ -516,15 +628,22 @@ int main(int argc, char* argv[])
     	}
     }
 
+    if (shm_window && !shm_client) {
+	    printf("ERROR: --window needs --shm!\n");
+	    print_usage();
+	    exit(STATE_UNKNOWN);
+    }
+
     /* check if either one monitor option is used
      * you can mix as many options as you want... even if it doesn't make sense at all */
-    if ( entitlement_critical+
-		    entitlement_critical_pct+
-		    entitlement_warning +
-		    entitlement_warning_pct +
-		    vcpu_busy_warning_pct +
-		    vcpu_busy_critical_pct == 0 ) {
-	    printf("ERROR: Specify at least on option -ew, -ec, -vbw, -vbc!\n");
+    if ( entitlement_critical.set +
+		    entitlement_critical_pct.set +
+		    entitlement_warning.set +
+		    entitlement_warning_pct.set +
+		    vcpu_busy_warning_pct.set +
+		    vcpu_busy_critical_pct.set +
+		    vcsw_invol_warning.set + vcsw_invol_critical.set == 0 ) {
+	    printf("ERROR: Specify at least on option -ew, -ec, -vbw, -vbc, --vcsw-invol-warning, --vcsw-invol-critical!\n");
 	    print_usage();
 	    exit(STATE_UNKNOWN);
     }
@@ -532,91 +651,75 @@ int main(int argc, char* argv[])
     /* 2 structures for difference calculation */
     perfstat_partition_total_t last_lparstats, lparstats;
 
-    /* API variables and helpers */
-    u_longlong_t last_time_base;
-    u_longlong_t last_pcpu_user, last_pcpu_sys, last_pcpu_idle, last_pcpu_wait;
-
-    u_longlong_t dlt_pcpu_user, dlt_pcpu_sys, dlt_pcpu_idle, dlt_pcpu_wait;
-    u_longlong_t delta_time_base;
-    u_longlong_t delta_purr;
-    double phys_proc_consumed=0, entitlement=0, percent_ent=0, vcpu_busy=0;
-    int max_entitlement=0;
-
-    /* retrieve the logical partition metrics */
-    if (!perfstat_partition_total(NULL, &last_lparstats, sizeof(perfstat_partition_total_t), 1)) {
-        	printf("ENTITLEMENT UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+    if (shm_client) {
+	/* results of the sampler daemon */
+	read_shm_snapshot();
+    } else {
+	/* retrieve the logical partition metrics */
+	if (!perfstat_partition_total(NULL, &last_lparstats, sizeof(perfstat_partition_total_t), 1)) {
+		printf("ENTITLEMENT UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
 		exit(STATE_UNKNOWN);
+	}
+	lpar_type = last_lparstats.type;
     }
 
     /* are we dedicated donating? */
-    if(last_lparstats.type.b.donate_enabled)
+    if(lpar_type.b.donate_enabled)
 	dedicated_donating = 1;
 
     /* No entitlement and pool data on dedicated LPARs */
-    if ( ! dedicated_donating && ! last_lparstats.type.b.shared_enabled ) {
+    if ( ! dedicated_donating && ! lpar_type.b.shared_enabled ) {
     	printf("ENT_POOLS UNKNOWN Entitlement and pool data not available in dedicated LPAR mode\n");
 	exit(STATE_UNKNOWN);
     }
 
-    sleep(interval);
+    if (!shm_client) {
+	sleep(interval);
 
-    /* retrieve the logical partition metrics... again */
-    if (!perfstat_partition_total(NULL, &lparstats, sizeof(perfstat_partition_total_t), 1)) {
-        	printf("ENTITLEMENT UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
+	/* retrieve the logical partition metrics... again */
+	if (!perfstat_partition_total(NULL, &lparstats, sizeof(perfstat_partition_total_t), 1)) {
+		printf("ENTITLEMENT UNKNOWN Error getting perfstat data from perfstat_partition_total\n");
 		exit(STATE_UNKNOWN);
-    }
-
-    /* all last_* values were set in the previous run, the deltas is what we want */
-    /* physc consists of usr+sys+wait+idle  */
-    dlt_pcpu_user  = lparstats.puser - last_lparstats.puser;
-    dlt_pcpu_sys   = lparstats.psys  - last_lparstats.psys;
-    dlt_pcpu_idle  = lparstats.pidle - last_lparstats.pidle;
-    dlt_pcpu_wait  = lparstats.pwait - last_lparstats.pwait;
-
-    delta_purr = dlt_pcpu_user + dlt_pcpu_sys + dlt_pcpu_idle + dlt_pcpu_wait;
-
-    /* get entitlement of lpar */
-    entitlement = (double)lparstats.entitled_proc_capacity / 100.0 ;
-
-    /* get number of virtual processors = maximum entitlement */
-    max_entitlement = lparstats.online_cpus;
-
-    /* new delta timer */
-    delta_time_base = lparstats.timebase_last - last_lparstats.timebase_last;
-
-    /* Physical Processor Consumed = Entitlement Consumed */
-    phys_proc_consumed = (double)delta_purr / (double)delta_time_base;
+	}
 
-    /* Percentage of Entitlement Consumed */
-    percent_ent = (phys_proc_consumed / entitlement) * 100;
+	calculate_values(&last_lparstats, &lparstats);
+    }
 
-    /* Percentage of vCPU busy */ 
-    vcpu_busy = (phys_proc_consumed / (double)max_entitlement) * 100;
+    if ((vcsw_invol_warning.set || vcsw_invol_critical.set) && !vcsw_available) {
+	printf("ENTITLEMENT UNKNOWN vcsw_invol is not available%s!\n", shm_client ? " with --shm" : "");
+	exit(STATE_UNKNOWN);
+    }
 
     /* we run in shared LPAR mode? */
-    if (lparstats.type.b.shared_enabled) {
+    if (lpar_type.b.shared_enabled) {
 
 	/* Compare critical and warning values */
 	
 	/* Entitlement checks */
 	/* maximum percentage is 2000% only on LPARs with minimum entitlement of 0.05 per virtual processor
 	 * effective maximum percentage decreases when entitlement is increased, this is currently not checked for sanity */
-	temp_state=get_new_status("Entitlement percentage check", percent_ent, entitlement_warning_pct, entitlement_critical_pct);
+	temp_state=get_range_status("Entitlement percentage check", percent_ent, &entitlement_warning_pct, &entitlement_critical_pct);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	ent_state = max_state(ent_state, temp_state);			/* entitlement monitor state */
 
-	temp_state=get_new_status("Entitlement check", phys_proc_consumed, entitlement_warning, entitlement_critical);
+	temp_state=get_range_status("Entitlement check", phys_proc_consumed, &entitlement_warning, &entitlement_critical);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	ent_state = max_state(ent_state, temp_state);			/* entitlement monitor state */
 	
 	/* vCPU busy checks */
-	temp_state=get_new_status("vCPU busy percentage check",vcpu_busy, vcpu_busy_warning_pct, vcpu_busy_critical_pct);
+	temp_state=get_range_status("vCPU busy percentage check",vcpu_busy, &vcpu_busy_warning_pct, &vcpu_busy_critical_pct);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	vcpu_busy_state = max_state(ent_state,temp_state);		/* vcpu busy monitor state */
 
+	/* involuntary virtual context switches */
+	temp_state=get_range_status("Involuntary virtual context switch check", vcsw_invol, &vcsw_invol_warning, &vcsw_invol_critical);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	vcsw_state = max_state(vcsw_state, temp_state);			/* virtual context switch state */
+
 	/* when strict checking enabled, do sanity checks too */
 	if (strict) {
 		if ( phys_proc_consumed == 0 ||
@@ -644,7 +747,7 @@ int main(int argc, char* argv[])
 
 	}
 
-	printf("ENTITLEMENT %s ent_used=%.2f(%s) ent=%.2f ent_max=%d vcpu_busy=%.2f%%(%s) |ent_used=%.2f ent=%.2f ent_max=%d vcpu_busy=%.2f\n",
+	printf("ENTITLEMENT %s ent_used=%.2f(%s) ent=%.2f ent_max=%d vcpu_busy=%.2f%%(%s)%s |ent_used=%.2f ent=%.2f ent_max=%d vcpu_busy=%.2f%s\n",
 			states[ent_pool_state],
 			phys_proc_consumed,
 			states[ent_state],
@@ -652,10 +755,12 @@ int main(int argc, char* argv[])
 			max_entitlement,
 			vcpu_busy,
 			states[vcpu_busy_state],
+			vcsw_status(),
 			phys_proc_consumed,
 			entitlement,
 			max_entitlement,
-			vcpu_busy
+			vcpu_busy,
+			vcsw_perfdata()
 			);
 
 	exit(ent_pool_state);
@@ -672,22 +777,28 @@ int main(int argc, char* argv[])
 	/* Entitlement checks */
 	/* the effective maximum percentage is 100% with dedicated donating, but you can still enter 2000% on the command-line
 	 * this is currently not checked for sanity :-) */
-	temp_state=get_new_status("Entitlement percentage check", percent_ent, entitlement_warning_pct, entitlement_critical_pct);
+	temp_state=get_range_status("Entitlement percentage check", percent_ent, &entitlement_warning_pct, &entitlement_critical_pct);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* global monitor state */
 	ent_state = max_state(ent_state,temp_state);			/* entitlement monitor state */
 
-	temp_state=get_new_status("Entitlement check", phys_proc_consumed, entitlement_warning, entitlement_critical);
+	temp_state=get_range_status("Entitlement check", phys_proc_consumed, &entitlement_warning, &entitlement_critical);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* global monitor state */
 	ent_state = max_state(ent_state,temp_state);			/* entitlement monitor state */
 
 	/* vCPU busy checks */
-	temp_state=get_new_status("vCPU busy percentage check", vcpu_busy, vcpu_busy_warning_pct, vcpu_busy_critical_pct);
+	temp_state=get_range_status("vCPU busy percentage check", vcpu_busy, &vcpu_busy_warning_pct, &vcpu_busy_critical_pct);
 
 	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
 	vcpu_busy_state = max_state(ent_state,temp_state);		/* vcpu busy monitor state */
 
+	/* involuntary virtual context switches */
+	temp_state=get_range_status("Involuntary virtual context switch check", vcsw_invol, &vcsw_invol_warning, &vcsw_invol_critical);
+
+	ent_pool_state = max_state(ent_pool_state, temp_state);		/* globale monitor state */
+	vcsw_state = max_state(vcsw_state, temp_state);			/* virtual context switch state */
+
 	/* when strict checking enabled, do sanity checks too */
 	if (strict) {
 		if ( phys_proc_consumed == 0 ||
@@ -709,17 +820,19 @@ int main(int argc, char* argv[])
 				);
 	}
 
-	printf("ENTITLEMENT %s ent_used=%.2f(%s) ent=%.2f ent_max=%d vcpu_busy=%.2f%% |ent_used=%.2f ent=%.2f ent_max=%d vcpu_busy=%.2f\n",
+	printf("ENTITLEMENT %s ent_used=%.2f(%s) ent=%.2f ent_max=%d vcpu_busy=%.2f%%%s |ent_used=%.2f ent=%.2f ent_max=%d vcpu_busy=%.2f%s\n",
 			states[ent_pool_state],
 			phys_proc_consumed,
 			states[ent_state],
 			entitlement,
 			max_entitlement,
 			vcpu_busy,
+			vcsw_status(),
 			phys_proc_consumed,
 			entitlement,
 			max_entitlement,
-			vcpu_busy
+			vcpu_busy,
+			vcsw_perfdata()
 	      		);
 
 	exit(ent_pool_state);
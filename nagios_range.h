@@ -0,0 +1,98 @@
+/*
+ * nagios plugin threshold ranges, included by check_ent_pools.c, check_entitlement.c and
+ * check_cpu_pools.c after states[] and verbose, so all of them parse and check thresholds the same way
+ *
+ * This nagios plugin comes with ABSOLUTELY NO WARRANTY. You may redistribute
+ * copies of the plugin under the terms of the GNU General Public License.
+ * For more information about these matters, see the file named COPYING.
+*/
+#ifndef NAGIOS_RANGE_H
+#define NAGIOS_RANGE_H
+
+int is_numeric (char *number);
+
+/* nagios plugin range of a threshold, parsed once: the value is alerted outside start..end,
+ * or inside with @ */
+struct range {
+	char set;		/* threshold given */
+	char inside;		/* @: alert inside the range */
+	char given_start;	/* start given, not the implicit 0 of a bare number or an open end */
+	char given_end;		/* end given, not an open end */
+	double start, end;	/* -INFINITY (~) and INFINITY for open ends */
+};
+
+/* the value is alerted by the range */
+int range_alert(struct range *r, double value)
+{
+	int outside = value < r->start || value > r->end;
+
+	return r->set && (r->inside ? !outside : outside);
+}
+
+/* get monitor status of a value with warning and critical ranges (verbose message included)
+ * an unset range is not monitored */
+int get_range_status(char *verbose_message, double value, struct range *warn, struct range *crit)
+{
+	int state = STATE_OK;
+
+	if (range_alert(warn, value)) {
+		state = STATE_WARNING;
+	}
+	if (range_alert(crit, value)) {
+		state = STATE_CRITICAL;
+	}
+
+	if (verbose) {
+		/* display NAN means, range was not used for comparison */
+		printf("%s state -> %s (val=%.2f warn=%s%.2f:%.2f crit=%s%.2f:%.2f)\n",
+			verbose_message,
+			states[state],
+			value,
+			warn->inside ? "@" : "", warn->set ? warn->start : NAN, warn->set ? warn->end : NAN,
+			crit->inside ? "@" : "", crit->set ? crit->start : NAN, crit->set ? crit->end : NAN
+			);
+	}
+	return state;
+}
+
+/* parse a nagios plugin range [@][start:][end], start ~ is minus infinity, an empty end is infinity
+ * a bare number keeps the direction of the threshold: alert above it, or below it when lower is set
+ * returns FALSE when arg is no range */
+int parse_range(char *arg, int lower, struct range *r)
+{
+	char *colon;
+
+	r->inside = (*arg == '@');
+	if (r->inside)
+		arg++;
+	if ((colon = strchr(arg, ':')) == NULL) {
+		if (!is_numeric(arg))
+			return FALSE;
+		r->start = lower && !r->inside ? atof(arg) : 0;
+		r->end = lower && !r->inside ? INFINITY : atof(arg);
+		r->given_start = lower && !r->inside;
+		r->given_end = !r->given_start;
+	} else {
+		*colon++ = 0;
+		r->given_start = *arg != 0 && strcmp(arg, "~") != 0;
+		r->given_end = *colon != 0;
+		if (strcmp(arg, "~") == 0)
+			r->start = -INFINITY;
+		else if (*arg == 0 || is_numeric(arg))
+			r->start = atof(arg);
+		else
+			return FALSE;
+		if (*colon == 0)
+			r->end = INFINITY;
+		else if (is_numeric(colon))
+			r->end = atof(colon);
+		else
+			return FALSE;
+		if (r->start > r->end)
+			return FALSE;
+	}
+	r->set = TRUE;
+	return TRUE;
+}
+
+#endif /* NAGIOS_RANGE_H */
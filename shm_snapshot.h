@@ -0,0 +1,102 @@
+/*
+ * shared memory snapshot of the sampler daemon (check_ent_pools --daemon), included by
+ * check_ent_pools.c, check_entitlement.c and check_cpu_pools.c, so all of them use the same layout
+ *
+ * This nagios plugin comes with ABSOLUTELY NO WARRANTY. You may redistribute
+ * copies of the plugin under the terms of the GNU General Public License.
+ * For more information about these matters, see the file named COPYING.
+*/
+#ifndef SHM_SNAPSHOT_H
+#define SHM_SNAPSHOT_H
+
+/* snapshot of the monitoring results published by the sampler daemon (check_ent_pools --daemon)
+ * in shared memory, seq, version, size and pid lead the snapshot in all versions */
+#define SHM_KEY		0x454e5053	/* "ENPS" */
+#define SHM_VERSION	4
+#define SHM_WINDOWS	4		/* sampling interval of the daemon, 1, 5 and 15 minutes */
+#define SHM_READ_TRIES	1000		/* 1 ms apart, the daemon writes the snapshot in microseconds */
+#define SHM_MAX_AGE	10		/* seconds, the daemon publishes every second */
+
+/* monitoring results over one window, every field needs an entry in window_fields of check_ent_pools.c */
+struct shm_window {
+	double seconds;			/* measured period, shorter than the window while the daemon is young */
+	double phys_proc_consumed, percent_ent, vcpu_busy;
+	double pool_busy_time, pool_busy_time_pct, pool_free_time, pool_free_time_pct;
+	double shcpu_busy_time, shcpu_busy_time_pct, shcpu_free_time, shcpu_free_time_pct;
+	double vcsw_vol, vcsw_invol;	/* virtual context switches per vCPU and second */
+};
+
+struct shm_snapshot {
+	volatile unsigned int seq;	/* seqlock, odd while the daemon writes */
+	unsigned int version;
+	unsigned int size;		/* sizeof(struct shm_snapshot) */
+	pid_t pid;			/* pid of the daemon */
+	int interval;			/* sampling interval of the daemon */
+	time_t updated;			/* wall clock time of the last sample */
+	double late;			/* wake-up lateness of the daemon at the last sample in seconds */
+	double late_max;		/* maximum wake-up lateness over the last minute */
+	perfstat_partition_type_t type;
+	int pool_id;
+	int phys_cpus_pool;
+	int max_entitlement;
+	u_longlong_t shcpus_in_sys;
+	double entitlement;
+	struct shm_window windows[SHM_WINDOWS];
+};
+
+/* window lengths in seconds (0 is the sampling interval) and their names for --window */
+int shm_window_length[SHM_WINDOWS] = { 0, 60, 300, 900 };
+char *shm_window_names[SHM_WINDOWS] = { "", "1m", "5m", "15m" };
+
+/* orders the snapshot stores and loads against the sequence counter */
+#ifdef __GNUC__
+#define memory_barrier()	__sync_synchronize()
+#else
+#define memory_barrier()	__lwsync()	/* xlC builtin */
+#endif
+
+/* copy the latest consistent snapshot of the sampler daemon, plugin is the prefix of the messages
+ * exits with UNKNOWN when there is no daemon, it runs another version, it stalled or its data is outdated */
+void copy_shm_snapshot(const char *plugin, struct shm_snapshot *snapshot, int verbose)
+{
+	struct shm_snapshot *shm;
+	unsigned int seq;
+	int shmid, tries;
+
+	if ((shmid = shmget(SHM_KEY, 0, 0)) < 0 ||
+	    (shm = (struct shm_snapshot *)shmat(shmid, NULL, SHM_RDONLY)) == (void *)-1) {
+		printf("%s UNKNOWN No sampler daemon running (check_ent_pools --daemon)\n", plugin);
+		exit(STATE_UNKNOWN);
+	}
+	if (shm->version != SHM_VERSION || shm->size != sizeof(struct shm_snapshot)) {
+		printf("%s UNKNOWN Sampler daemon version does not match\n", plugin);
+		exit(STATE_UNKNOWN);
+	}
+
+	/* seq stays odd when the daemon was stopped in the middle of an update */
+	for (tries = 0; ; tries++) {
+		if (tries == SHM_READ_TRIES) {
+			printf("%s UNKNOWN Sampler daemon stalled\n", plugin);
+			exit(STATE_UNKNOWN);
+		}
+		if (tries > 0)
+			usleep(1000);
+		if ((seq = shm->seq) & 1)
+			continue;	/* daemon is writing */
+		memory_barrier();
+		memcpy(snapshot, (void *)shm, sizeof(struct shm_snapshot));
+		memory_barrier();
+		if (seq == shm->seq)
+			break;
+	}
+	shmdt((void *)shm);
+
+	if (verbose) { printf("Sampler daemon pid %d, interval %d, snapshot %.0f seconds old\n",
+				(int)snapshot->pid, snapshot->interval, difftime(time(NULL), snapshot->updated)); }
+	if (snapshot->updated == 0 || difftime(time(NULL), snapshot->updated) > SHM_MAX_AGE) {
+		printf("%s UNKNOWN Sampler daemon data is outdated\n", plugin);
+		exit(STATE_UNKNOWN);
+	}
+}
+
+#endif /* SHM_SNAPSHOT_H */